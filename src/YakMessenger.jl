@@ -8,6 +8,7 @@ module YakMessenger
 export YakConnection
 
 using Sockets
+using Mmap
 
 struct YakError
     mesg::String
@@ -17,7 +18,12 @@ Base.showerror(io::IO, err::YakError) = print(io, "YakError: ", err.mesg)
 
 mutable struct YakConnection{T<:IO}
     io::T
-    YakConnection(io::IO) where {IO} = finalizer(close, new{IO}(io))
+    lock::ReentrantLock # to serialize request/answer exchanges between tasks
+    stamp::Float64 # time of last activity (for reaping idle connections)
+    spin::Float64  # time budget in seconds for busy-polling before blocking
+    busy::Int      # number of received requests not yet answered (never reaped if > 0)
+    YakConnection(io::IO; spin::Real = 0) where {IO} =
+        finalizer(close, new{IO}(io, ReentrantLock(), time(), spin, 0))
 end
 
 # Extend base functions.
@@ -32,7 +38,7 @@ end
 
 """
     import YakMessenger
-    conn = YakMessenger.connect(host="localhost", port)
+    conn = YakMessenger.connect(host="localhost", port; spin=0)
 
     using YakMessenger
     conn = YakConnection(host="localhost" port)
@@ -47,24 +53,104 @@ To send a command to the server (and receive an answer), simply do:
 where `command` is a string whose interpretation depends on the server.
 
 The connection is automatically closed when `conn` is garbage collected but may be
-explicitly closed by `close(conn)`.
+explicitly closed by `close(conn)`. To have the connection closed as soon as it is no
+longer needed, use the `do`-block syntax:
+
+    YakMessenger.connect(host, port) do conn
+        answer = conn(command)
+        ...
+    end
+
+Keyword `spin` specifies a time budget in seconds (0 by default) during which the client
+busy-polls the connection for incoming data before blocking. Spinning trades CPU time for
+lower latency of the answers: it avoids the wake-up delay of the scheduler when answers
+are expected within a few microseconds. The budget can be changed at any time by setting
+`conn.spin`. See [`YakMessenger.pin_thread`](@ref) to dedicate a CPU core to a polling
+thread.
 
 See also [`YakMessenger.send_message`](@ref) and [`YakMessenger.recv_message`](@ref).
 
 """
-YakConnection(port::Integer) = connect(port)
-YakConnection(host, port::Integer) = connect(host, port)
+YakConnection(port::Integer; kwds...) = connect(port; kwds...)
+YakConnection(host, port::Integer; kwds...) = connect(host, port; kwds...)
 
-connect(port::Integer) = YakConnection(Sockets.connect(port))
-connect(host, port::Integer) = YakConnection(Sockets.connect(host, port))
+connect(port::Integer; kwds...) = YakConnection(Sockets.connect(port); kwds...)
+connect(host, port::Integer; kwds...) = YakConnection(Sockets.connect(host, port); kwds...)
+
+connect(f::Function, port::Integer; kwds...) = connect(f, "localhost", port; kwds...)
+function connect(f::Function, host, port::Integer; kwds...)
+    conn = connect(host, port; kwds...)
+    try
+        return f(conn)
+    finally
+        close(conn)
+    end
+end
 
 function (conn::YakConnection)(mesg::AbstractString)
-    send_message(conn, 'X', mesg)
-    type, answer = recv_message(conn)
+    type, answer = lock(conn.lock) do
+        send_message(conn, 'X', mesg)
+        type, answer = recv_message(Vector{UInt8}, conn)
+        while type == 'K'
+            # Reassemble a streamed result.
+            type, chunk = recv_message(Vector{UInt8}, conn)
+            append!(answer, chunk)
+        end
+        return type, String(answer)
+    end
     type == 'E' && throw(YakError(answer))
+    type == 'B' && throw(YakError("server busy: " * answer))
     return answer
 end
 
+"""
+    YakMessenger.stream(f, conn, expr)
+
+Send the expression `expr` to be evaluated by the server connected by `conn` and call
+`f(chunk)` for each successive chunk of the result (a vector of bytes which may be
+reused for the next chunk). A `YakError` is thrown if the server reported an error.
+
+A Yorick server sends large results in chunks of bounded size if the client has called
+`YakMessenger.stream_results(conn, size)` with `size` the maximum chunk size in bytes:
+the result is then consumed incrementally and the server serves its other clients
+between chunks. Otherwise, `f` is called once with the whole result.
+
+"""
+function stream(f, conn::YakConnection, mesg::AbstractString)
+    buf = UInt8[]
+    type = lock(conn.lock) do
+        send_message(conn, 'X', mesg)
+        while true
+            type, buf = recv_message!(buf, conn)
+            type == 'K' || return type
+            f(buf)
+        end
+    end
+    type == 'E' && throw(YakError(String(buf)))
+    type == 'B' && throw(YakError("server busy: " * String(buf)))
+    f(buf)
+    return nothing
+end
+
+"""
+    YakMessenger.stream_results(conn, size)
+
+Ask the server connected by `conn` to send results larger than `size` bytes as a
+sequence of chunks of at most `size` bytes (0 to disable). This is done by a message of
+type `K` (for chun**K**s) whose content is `size`. Chunks but the last one are sent as
+messages of type `K`, the last one as a message of type `R`. Streamed results are
+reassembled by `conn(expr)` or consumed incrementally by
+[`YakMessenger.stream`](@ref).
+
+"""
+function stream_results(conn::YakConnection, size::Integer)
+    size ≥ 0 || throw(ArgumentError("chunk size must be nonnegative"))
+    lock(conn.lock) do
+        send_message(conn, 'K', string(size))
+    end
+    return nothing
+end
+
 """
     YakMessenger.send_message(conn, type, mesg)
 
@@ -81,7 +167,31 @@ function send_message(conn::YakConnection, type::AbstractChar,
                       mesg::AbstractVector{T}) where {T}
     isconcretetype(T) || throw(ArgumentError(
         "message content must have elements of concrete type, got `$T`"))
-    nbytes = sizeof(T)*length(mesg) # number of bytes of the message
+    return send_parts(conn, type, mesg)
+end
+
+# Send a message whose content is the concatenation of `parts` (strings, vectors of
+# elements of concrete type or bytes).
+function send_parts(conn::YakConnection, type::AbstractChar, part, parts...)
+    header = message_header(type, nbytes(part, parts...))
+    try
+        write(conn.io, header, part, parts..., UInt8('\n'))
+        flush(conn.io)
+        conn.stamp = time()
+    catch ex
+        close(conn)
+        rethrow(ex)
+    end
+    return nothing
+end
+
+nbytes(x, y, z...) = nbytes(x) + nbytes(y, z...)
+nbytes(x::AbstractString) = sizeof(x)
+nbytes(x::UInt8) = 1
+nbytes(x::AbstractVector{T}) where {T} = sizeof(T)*length(x)
+
+# Yield the bytes of the header of a message of given type and content size.
+function message_header(type::AbstractChar, nbytes::Integer)
     ndigits, m = 1, 10
     while m ≤ nbytes
         ndigits += 1
@@ -99,14 +209,18 @@ function send_message(conn::YakConnection, type::AbstractChar,
     end
     header[i += 1] = '\n'
     @assert i == length(header)
-    try
-        write(conn.io, header, mesg, UInt8('\n'))
-        flush(conn.io)
-    catch ex
-        close(conn)
-        rethrow(ex)
-    end
-    return nothing
+    return header
+end
+
+# Yield all the bytes of a message (header, content and final newline) so that they can be
+# sent as is to several peers.
+function encode_message(type::AbstractChar, mesg::AbstractVector{UInt8})
+    header = message_header(type, length(mesg))
+    frame = Vector{UInt8}(undef, length(header) + length(mesg) + 1)
+    copyto!(frame, 1, header, 1, length(header))
+    copyto!(frame, length(header) + 1, mesg, 1, length(mesg))
+    frame[end] = '\n'
+    return frame
 end
 
 """
@@ -127,44 +241,127 @@ function recv_message(::Type{String}, conn::YakConnection)
 end
 
 function recv_message(::Type{Vector{UInt8}}, conn::YakConnection)
-    # Read the message header. The minimal header size if 4 bytes. The remaining bytes are
-    # read one by one to avoid blocking.
-    newline = UInt8('\n')
-    buffer = Array{UInt8}(undef, 4)
-    read!(conn.io, buffer)
-    mesg_type = Char(buffer[1]) # message type
-    if buffer[2] != UInt8(':')
+    mesg_type, mesg_size = recv_header(conn)
+    mesg = recv_content!(conn, Vector{UInt8}(undef, mesg_size))
+    return mesg_type, mesg
+end
+
+"""
+    YakMessenger.recv_message!(buf, conn) -> (type, buf)
+
+Receive a message from the connected peer on `conn` storing its content in `buf`, a
+vector of bytes which is resized as needed. The result is a 2-tuple: `type` is the
+message type, `buf` is the message content. Since a vector keeps its capacity when
+shrunk, reusing the same buffer for many messages avoids any heap allocation as soon as
+the buffer has grown to the size of the largest messages.
+
+See also [`YakMessenger.recv_message`](@ref).
+
+"""
+function recv_message!(buf::Vector{UInt8}, conn::YakConnection)
+    mesg_type, mesg_size = recv_header(conn)
+    return mesg_type, recv_content!(conn, resize!(buf, mesg_size))
+end
+
+"""
+    YakMessenger.recv_message_mmap(conn, path) -> (type, mesg)
+
+Receive a message from the connected peer on `conn` and store its content in the file
+`path`. The file is created (or truncated) and sized to the length of the message content
+which is then read directly into a memory-mapped view of the file. This avoids allocating
+a temporary buffer for large payloads that have to be saved anyway. The result is a
+2-tuple: `type` is the message type, `mesg` is a memory-mapped vector of bytes which
+remains valid (and backed by the file) after the call.
+
+See also [`YakMessenger.recv_message`](@ref).
+
+"""
+function recv_message_mmap(conn::YakConnection, path::AbstractString)
+    mesg_type, mesg_size = recv_header(conn)
+    mesg = try
+        open(path, "w+") do io
+            Mmap.mmap(io, Vector{UInt8}, mesg_size)
+        end
+    catch ex
+        # Connection is no longer synchronized on a message boundary.
+        close(conn)
+        rethrow(ex)
+    end
+    if mesg_size > 0 && isdefined(Mmap, :madvise!)
+        Mmap.madvise!(mesg, Mmap.MADV_SEQUENTIAL)
+    end
+    return mesg_type, recv_content!(conn, mesg)
+end
+
+# Maximum number of digits of the size in a message header, any such size fits in an `Int`
+# (18 digits on 64-bit systems).
+const MAX_SIZE_DIGITS = ndigits(typemax(Int)) - 1
+
+# Read the message header and return the message type and the size of its content. The
+# header is read byte by byte (the stream is buffered) to avoid blocking and allocations.
+function recv_header(conn::YakConnection)
+    io = conn.io
+    conn.spin > 0 && spin_wait(conn)
+    mesg_type = Char(read(io, UInt8)) # message type
+    conn.stamp = time()
+    byte = read(io, UInt8)
+    if byte != UInt8(':')
         close(conn)
         throw(malformed_message(':', byte))
     end
-    local byte
     mesg_size = 0
-    index = 2
+    ndigits = 0
     while true
-        index += 1
-        byte = index ≤ length(buffer) ? buffer[index] : read(conn.io, UInt8)
-        if byte == UInt8('\n') && index ≥ 4
-            break
-        elseif UInt8('0') ≤ byte ≤ UInt8('9')
+        byte = read(io, UInt8)
+        if UInt8('0') ≤ byte ≤ UInt8('9')
+            if ndigits ≥ MAX_SIZE_DIGITS
+                # More digits may overflow the size.
+                close(conn)
+                throw(YakError(
+                    "malformed message, size has more than $MAX_SIZE_DIGITS digits"))
+            end
             digit = Int(byte) - Int('0')
             mesg_size = digit + 10*mesg_size
+            ndigits += 1
+        elseif byte == UInt8('\n') && ndigits ≥ 1
+            break
         else
             close(conn)
-            throw(malformed_message("a digit", byte))
+            throw(malformed_message(ndigits ≥ 1 ? "a digit or a newline" : "a digit", byte))
         end
     end
+    return mesg_type, mesg_size
+end
 
-    # Read the remaining part of the message, that is its content.
-    read!(conn.io, resize!(buffer, mesg_size + 1)) # +1 for the final newline
-    byte = buffer[end]
+# Read the content of a message, whose header has just been read, into `mesg` and check
+# the final newline. If `mesg` is a vector of plain data, its bytes are directly read.
+function recv_content!(conn::YakConnection, mesg::AbstractVector)
+    read!(conn.io, mesg)
+    byte = read(conn.io, UInt8)
     if byte != UInt8('\n')
         close(conn)
         throw(malformed_message('\n', byte))
     end
-    mesg = resize!(buffer, mesg_size)
-    return mesg_type, mesg
+    return mesg
 end
 
+include("server.jl")
+include("memory.jl")
+include("spin.jl")
+include("async.jl")
+include("requests.jl")
+include("hedge.jl")
+include("broadcast.jl")
+include("broker.jl")
+include("proxy.jl")
+include("kv.jl")
+include("codecs.jl")
+include("numeric.jl")
+include("ranges.jl")
+include("handles.jl")
+include("duplex.jl")
+include("forward.jl")
+
 hex(b::Unsigned) = string(b, base=16)
 hex(c::Char) = hex(Integer(c))
 
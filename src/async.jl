@@ -0,0 +1,280 @@
+# Slot where to store the answer to a request. There is room for the answer and for a
+# timeout notification so that the task reading the answers never blocks.
+const ReplySlot = Channel{Tuple{Char,Vector{UInt8}}}
+new_slot() = ReplySlot(2)
+
+# Pseudo message type to notify a timeout in a reply slot.
+const TIMEOUT = '\0'
+
+"""
+    aconn = YakMessenger.AsyncConnection(conn; unordered=false, maxbytes=typemax(Int))
+    aconn = YakMessenger.AsyncConnection([host,] port; unordered=false,
+                                         maxbytes=typemax(Int))
+
+Build an asynchronous connection on top of the Yak connection `conn` or of a new
+connection to the server on `host` and `port`. The asynchronous connection takes
+ownership of `conn` which shall no longer be used directly.
+
+With an asynchronous connection, requests are pipelined: many tasks may have requests in
+flight on the same connection at the same time, a background task dispatches the answers
+(which come in the order of the requests) to the waiting tasks:
+
+    req = YakMessenger.request(aconn, expr; timeout=Inf)
+    ...                  # do something else
+    answer = fetch(req)  # wait for the answer
+
+or simply `answer = aconn(expr)`. There is no thread nor callback involved, thousands of
+logical requests may be in flight using tasks only.
+
+Urgent requests (see [`YakMessenger.request`](@ref)) are sent on a secondary connection
+to the same server, opened when first needed, so that they do not wait behind bulk
+requests. This is only possible if the asynchronous connection has been built with the
+`host` and `port` of the server, otherwise urgent requests are sent on the main
+connection.
+
+If keyword `unordered` is true, the server is asked to send the answers as soon as they
+are ready rather than in the order of the requests, so that a slow request does not hold
+back the answers to the following ones. This is negotiated by a message of type `O`
+(for **O**ut-of-order) with content `1`: a server supporting it replies with a message
+of type `O` and content `1` and then precedes each answer by a message of type `I` whose
+content is the number of the request (see [`YakMessenger.cancel`](@ref) for the
+numbering); any other reply, or no reply within `NEGOTIATION_TIMEOUT` seconds (as from
+a server ignoring the message), means that answers will come in order. Whether answers
+may come out of order is given by `aconn.unordered`.
+
+Keyword `maxbytes` is the maximum number of bytes of an answer (after reassembly of an
+answer streamed in chunks). The content of a larger answer is skipped without being
+stored and the request fails with a `YakError`.
+
+"""
+mutable struct AsyncConnection{T<:YakConnection}
+    conn::T
+    pending::Dict{Int,ReplySlot} # slots of outstanding requests indexed by number
+    nsent::Int                   # number of sent requests
+    nrecv::Int                   # number of received answers (when in order)
+    host::Any                    # host and port of the server if known
+    port::Int
+    urgent::Any                  # secondary connection for urgent requests
+    unordered::Bool              # answers are tagged with their request number?
+    negotiating::Bool            # waiting for the reply to an `O` message?
+    maxbytes::Int                # maximum size of answers
+    function AsyncConnection(conn::T, host = nothing, port::Integer = 0;
+                             unordered::Bool = false,
+                             maxbytes::Integer = typemax(Int)) where {T<:YakConnection}
+        maxbytes ≥ 0 || throw(ArgumentError("maximum answer size must be nonnegative"))
+        aconn = new{T}(conn, Dict{Int,ReplySlot}(), 0, 0, host, port, nothing, false,
+                       false, maxbytes)
+        @async read_answers(aconn)
+        unordered && negotiate_unordered!(aconn)
+        return aconn
+    end
+end
+
+AsyncConnection(port::Integer; kwds...) = AsyncConnection("localhost", port; kwds...)
+AsyncConnection(host, port::Integer; kwds...) =
+    AsyncConnection(connect(host, port), host, port; kwds...)
+
+# Maximum number of seconds to wait for the reply to the negotiation of out-of-order
+# answers.
+const NEGOTIATION_TIMEOUT = 1.0
+
+# Ask the server to send answers as soon as they are ready. The reply is dispatched by
+# the task reading the answers. No requests are sent until the reply has been received
+# or the wait has timed out, so any message received meanwhile is the reply.
+function negotiate_unordered!(aconn::AsyncConnection)
+    aconn.negotiating = true
+    lock(aconn.conn.lock) do
+        send_message(aconn.conn, 'O', "1")
+    end
+    timedwait(() -> !aconn.negotiating, NEGOTIATION_TIMEOUT; pollint=0.001)
+    aconn.negotiating = false
+    return aconn
+end
+
+Base.isopen(aconn::AsyncConnection) = isopen(aconn.conn)
+
+function Base.close(aconn::AsyncConnection)
+    close(aconn.conn)
+    aconn.urgent === nothing || close(aconn.urgent)
+    return nothing
+end
+
+# Yield the connection to use for urgent requests.
+function urgent_connection(aconn::AsyncConnection)
+    aconn.host === nothing && return aconn
+    if aconn.urgent === nothing || !isopen(aconn.urgent)
+        aconn.urgent = AsyncConnection(connect(aconn.host, aconn.port);
+                                       unordered=aconn.unordered,
+                                       maxbytes=aconn.maxbytes)
+    end
+    return aconn.urgent
+end
+
+"""
+    req = YakMessenger.request(aconn, expr; timeout=Inf, urgent=false)
+
+Send the expression `expr` to be evaluated by the server on the asynchronous connection
+`aconn` and return immediately. The answer is retrieved by `fetch(req)` which blocks the
+calling task until the answer is available and which throws a `YakError` if the server
+reported an error or if no answer was received within `timeout` seconds (the late answer
+is then discarded). Calling `wait(req)` waits for the answer without retrieving it.
+
+If `timeout` is finite, it is also sent to the server as a deadline for the request (a
+message of type `D` preceding the request) so that the server can skip the request if it
+cannot start processing it in time.
+
+If `urgent` is true, the request is a short control command which should not wait behind
+bulk requests: it is sent on a secondary connection to the server, if possible, and it is
+marked as high priority (by a message of type `H` preceding the request) so that servers
+queuing requests process it first.
+
+A request may be cancelled by `YakMessenger.cancel(req)`.
+
+See also [`YakMessenger.AsyncConnection`](@ref).
+
+"""
+function request(aconn::AsyncConnection, expr::AbstractString;
+                 timeout::Real = Inf, urgent::Bool = false)
+    timeout > 0 || throw(ArgumentError("timeout must be positive"))
+    slot = new_slot()
+    urgent && (aconn = urgent_connection(aconn))
+    seq = submit!(aconn, slot, 'X', expr; timeout=timeout, urgent=urgent)
+    timer = nothing
+    if isfinite(timeout)
+        timer = Timer(timeout) do _
+            isready(slot) || put!(slot, (TIMEOUT, UInt8[]))
+        end
+    end
+    return YakRequest(aconn, seq, slot, timer)
+end
+
+(aconn::AsyncConnection)(expr::AbstractString) = fetch(request(aconn, expr))
+
+struct YakRequest
+    aconn::AsyncConnection # connection where the request was sent
+    seq::Int               # number of the request on this connection
+    slot::ReplySlot
+    timer::Union{Timer,Nothing} # to notify a timeout, closed once answered
+end
+
+# Stop the timer of an answered request so that it does not outlive the request.
+function stop_timer(req::YakRequest)
+    req.timer === nothing || close(req.timer)
+    return nothing
+end
+
+"""
+    YakMessenger.cancel(req)
+
+Ask the server to cancel the request `req` sent by [`YakMessenger.request`](@ref). This
+is done by sending a message of type `C` whose content is the number of the request on
+its connection (requests are numbered from 1 and messages of type `C`, `D`, `H`, `K`,
+and `O` are not counted). A server which supports cancellation drops the request if it
+is still queued or signals the handler processing it, and answers with a message of type
+`C`: `fetch(req)` then throws a `YakError`. Requests already answered are not affected.
+
+"""
+function cancel(req::YakRequest)
+    isready(req.slot) && return nothing
+    lock(req.aconn.conn.lock) do
+        send_message(req.aconn.conn, 'C', string(req.seq))
+    end
+    return nothing
+end
+
+Base.wait(req::YakRequest) = (wait(req.slot); stop_timer(req))
+
+function Base.fetch(req::YakRequest)
+    type, answer = fetch(req.slot)
+    stop_timer(req)
+    type == TIMEOUT && throw(YakError("no answer before timeout"))
+    type == 'E' && throw(YakError(String(copy(answer))))
+    type == 'B' && throw(YakError("server busy: " * String(copy(answer))))
+    type == 'C' && throw(YakError("request cancelled"))
+    return String(copy(answer))
+end
+
+# Send a message on an asynchronous connection and queue the slot to store the answer.
+# If `timeout` is finite, the message is preceded by a deadline message. If `urgent` is
+# true, the message is preceded by a high priority message. Return the number of the
+# request on the connection.
+function submit!(aconn::AsyncConnection, slot::ReplySlot, type::AbstractChar, mesg;
+                 timeout::Real = Inf, urgent::Bool = false)
+    return lock(aconn.conn.lock) do
+        seq = (aconn.nsent += 1)
+        aconn.pending[seq] = slot
+        try
+            urgent && send_message(aconn.conn, 'H', "")
+            isfinite(timeout) && send_message(aconn.conn, 'D', string(Float64(timeout)))
+            send_message(aconn.conn, type, mesg)
+        catch ex
+            fail_pending!(aconn, ex)
+        end
+        return seq
+    end
+end
+
+# Dispatch the answers to the slots of the pending requests. Answers come in the order
+# of the requests unless preceded by a message of type `I` with the request number.
+function read_answers(aconn::AsyncConnection)
+    try
+        tag = 0
+        chunks = UInt8[] # chunks of a streamed answer
+        toolarge = false # skipping the chunks of an answer exceeding `maxbytes`?
+        while isopen(aconn.conn)
+            type, size = recv_header(aconn.conn)
+            if toolarge || size > aconn.maxbytes - length(chunks)
+                # Skip the content without storing it, the stream stays in sync.
+                skip_content(aconn.conn, size)
+                chunks = UInt8[]
+                toolarge = (type == 'K')
+                toolarge && continue
+                type == 'I' && throw(YakError("invalid request number from server"))
+                type, mesg = 'E', Vector{UInt8}("answer too large")
+            else
+                mesg = recv_content!(aconn.conn, Vector{UInt8}(undef, size))
+                if type == 'K'
+                    append!(chunks, mesg)
+                    continue
+                elseif !isempty(chunks)
+                    mesg = append!(chunks, mesg)
+                    chunks = UInt8[]
+                end
+            end
+            if type == 'O'
+                # Reply to the negotiation of out-of-order answers, possibly late: the
+                # following answers are tagged if the server accepted.
+                aconn.unordered = String(mesg) == "1"
+                aconn.negotiating = false
+                continue
+            elseif aconn.negotiating
+                # A server unaware of the negotiation has answered the `O` message as a
+                # request.
+                aconn.negotiating = false
+                continue
+            elseif type == 'I'
+                n = tryparse(Int, String(mesg))
+                n === nothing && throw(YakError("invalid request number from server"))
+                tag = n
+                continue
+            end
+            n = tag > 0 ? tag : (aconn.nrecv += 1)
+            tag = 0
+            slot = pop!(aconn.pending, n, nothing)
+            slot === nothing && throw(YakError("unexpected message from server"))
+            put!(slot, (type, mesg))
+        end
+    catch ex
+        fail_pending!(aconn, ex)
+    end
+end
+
+# Close an asynchronous connection and answer its pending requests with an error.
+function fail_pending!(aconn::AsyncConnection, ex)
+    close(aconn.conn)
+    mesg = Vector{UInt8}("connection lost ($(typeof(ex)))")
+    for slot in values(aconn.pending)
+        put!(slot, ('E', mesg))
+    end
+    empty!(aconn.pending)
+end
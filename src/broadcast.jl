@@ -0,0 +1,46 @@
+"""
+    YakMessenger.broadcast(conns, expr; timeout=Inf) -> answers
+
+Send the expression `expr` to all the servers connected by `conns`, a collection of Yak
+connections, and gather their answers as they arrive. All requests are sent at once, so
+the whole exchange takes about one round-trip time instead of one per server.
+
+The result is a vector of the same length as `conns` where `answers[i]` is:
+
+- the answer (a string) of the `i`-th server in case of success;
+- the exception that was raised (a `YakError` if the server reported an error);
+- `nothing` if the `i`-th server did not answer within `timeout` seconds.
+
+A connection whose server did not answer in time remains busy until its answer has been
+received and discarded.
+
+See also [`YakMessenger.Hedger`](@ref).
+
+"""
+function broadcast(conns, expr::AbstractString; timeout::Real = Inf)
+    timeout > 0 || throw(ArgumentError("timeout must be positive"))
+    n = length(conns)
+    answers = Vector{Any}(nothing, n)
+    n == 0 && return answers
+    chnl = Channel{Tuple{Int,Any}}(n + 1)
+    for (i, conn) in enumerate(conns)
+        @async try
+            put!(chnl, (i, conn(expr)))
+        catch ex
+            put!(chnl, (i, ex))
+        end
+    end
+    timer = isfinite(timeout) ? Timer(_ -> put!(chnl, (0, nothing)), timeout) : nothing
+    try
+        pending = n
+        while pending > 0
+            i, val = take!(chnl)
+            i == 0 && break # timeout expired
+            answers[i] = val
+            pending -= 1
+        end
+    finally
+        timer === nothing || close(timer)
+    end
+    return answers
+end
@@ -0,0 +1,334 @@
+# A published frame and its topic.
+struct PubFrame
+    topic::String
+    data::Vector{UInt8} # encoded message, shared by all subscribers
+end
+
+mutable struct BrokerClient
+    conn::YakConnection{TCPSocket}
+    queue::Vector{PubFrame} # outbound frames
+    cond::Condition         # to signal the writer that the queue is not empty
+    topics::Set{String}     # subscribed topics
+    streams::Set{String}    # topics subscribed in latest-value mode
+    latest::Dict{String,PubFrame} # latest unsent frame of streamed topics
+    pending::Vector{String} # streamed topics with an unsent frame, in order
+    BrokerClient(conn::YakConnection{TCPSocket}) =
+        new(conn, PubFrame[], Condition(), Set{String}(),
+            Set{String}(), Dict{String,PubFrame}(), String[])
+end
+
+"""
+    broker = YakMessenger.Broker([host,] port=0; queue=64, policy=:drop_oldest,
+                                 maxbytes=2^26)
+
+Start a Yak publish/subscribe broker listening on `port` of `host` (localhost by
+default). If `port` is 0, a free port is chosen; `broker.port` yields the actual port
+number. The broker runs in background tasks until `close(broker)` is called.
+
+Clients connected to the broker subscribe to topics with
+[`YakMessenger.subscribe`](@ref) and publish frames on topics with
+[`YakMessenger.publish`](@ref). A published frame is encoded once and the same buffer is
+shared by the outbound queues of all the subscribers of the topic, so the cost of
+publishing does not depend on the size of the frame times the number of subscribers.
+
+Each subscriber has an outbound queue of at most `queue` frames. When a frame is
+published to a subscriber whose queue is full, `policy` specifies what to do:
+
+- `:drop_oldest` to drop the oldest queued frame;
+- `:conflate` to replace the most recent queued frame of the same topic, if any, by the
+  new one, and to drop the oldest queued frame otherwise;
+- `:disconnect` to disconnect the subscriber.
+
+A topic may also be subscribed in latest-value mode (see
+[`YakMessenger.subscribe`](@ref)), which is suitable for real-time telemetry: for such a
+topic, the broker keeps only the latest unsent frame for the subscriber and replaces it if
+a newer frame is published before it has been sent. A slow subscriber thus always
+receives the newest frame, never a backlog, and publishing takes a constant time
+whatever the speed of the subscribers.
+
+Messages whose content exceeds `maxbytes` bytes are skipped without being stored and
+answered by a message of type `E`.
+
+Call `YakMessenger.broker_stats(broker)` to retrieve the number of published, delivered
+and dropped frames and of disconnected slow subscribers.
+
+"""
+mutable struct Broker
+    port::Int
+    maxqueue::Int
+    policy::Symbol
+    maxbytes::Int              # maximum size of received messages
+    topics::Dict{String,Vector{BrokerClient}} # subscribers of each topic
+    clients::Set{BrokerClient} # all connected clients
+    published::Int             # number of published frames
+    delivered::Int             # number of frames sent to subscribers
+    dropped::Int               # number of frames dropped or replaced
+    disconnected::Int          # number of disconnected slow subscribers
+    srv::YakServer
+    function Broker(server::Sockets.TCPServer;
+                    queue::Integer = 64,
+                    policy::Symbol = :drop_oldest,
+                    maxbytes::Integer = 2^26)
+        queue ≥ 1 || throw(ArgumentError("queue size must be at least one"))
+        maxbytes ≥ 0 || throw(ArgumentError("maximum message size must be nonnegative"))
+        policy ∈ (:drop_oldest, :conflate, :disconnect) || throw(ArgumentError(
+            "policy must be one of `:drop_oldest`, `:conflate`, or `:disconnect`"))
+        port = Int(getsockname(server)[2])
+        broker = new(port, queue, policy, maxbytes, Dict{String,Vector{BrokerClient}}(),
+                     Set{BrokerClient}(), 0, 0, 0, 0)
+        broker.srv = serve(conn -> serve_client(broker, conn), server)
+        return broker
+    end
+end
+
+Broker(port::Integer = 0; kwds...) = Broker(listen(port); kwds...)
+Broker(host::IPAddr, port::Integer; kwds...) = Broker(listen(host, port); kwds...)
+Broker(host::AbstractString, port::Integer; kwds...) =
+    Broker(getaddrinfo(host), port; kwds...)
+
+Base.isopen(broker::Broker) = isopen(broker.srv)
+
+function Base.close(broker::Broker)
+    close(broker.srv)
+    for client in collect(broker.clients)
+        drop_client!(broker, client)
+    end
+    return nothing
+end
+
+broker_stats(broker::Broker) = (published    = broker.published,
+                                delivered    = broker.delivered,
+                                dropped      = broker.dropped,
+                                disconnected = broker.disconnected)
+
+"""
+    YakMessenger.subscribe(conn, topic; latest=false)
+
+Subscribe to the frames published on `topic` via the broker connected by `conn`. Frames
+are then received by [`YakMessenger.recv_published`](@ref).
+
+If keyword `latest` is true, the topic is subscribed in latest-value mode: frames
+published on the topic while a previous one has not yet been sent to the subscriber
+replace it, so that only the newest frame is delivered.
+
+See also [`YakMessenger.Broker`](@ref) and [`YakMessenger.unsubscribe`](@ref).
+
+"""
+subscribe(conn::YakConnection, topic::AbstractString; latest::Bool = false) =
+    send_message(conn, latest ? 'L' : 'S', check_topic(topic))
+
+"""
+    YakMessenger.unsubscribe(conn, topic)
+
+Cancel a subscription to the frames published on `topic` via the broker connected by
+`conn`.
+
+See also [`YakMessenger.subscribe`](@ref).
+
+"""
+unsubscribe(conn::YakConnection, topic::AbstractString) =
+    send_message(conn, 'U', check_topic(topic))
+
+"""
+    YakMessenger.publish(conn, topic, data)
+
+Publish `data` (a string or a vector) on `topic` via the broker connected by `conn`.
+
+See also [`YakMessenger.Broker`](@ref) and [`YakMessenger.subscribe`](@ref).
+
+"""
+publish(conn::YakConnection, topic::AbstractString, data::AbstractString) =
+    publish(conn, topic, codeunits(data))
+
+function publish(conn::YakConnection, topic::AbstractString,
+                 data::AbstractVector{T}) where {T}
+    isconcretetype(T) || throw(ArgumentError(
+        "published data must have elements of concrete type, got `$T`"))
+    return send_parts(conn, 'P', String(check_topic(topic)), UInt8('\n'), data)
+end
+
+"""
+    YakMessenger.recv_published(conn) -> (topic, data::Vector{UInt8})
+
+Receive the next frame published on one of the topics subscribed via the broker
+connected by `conn`.
+
+See also [`YakMessenger.subscribe`](@ref).
+
+"""
+function recv_published(conn::YakConnection)
+    type, mesg = recv_message(Vector{UInt8}, conn)
+    type == 'E' && throw(YakError(String(mesg)))
+    type == 'P' || throw(YakError("unexpected message type '$type'"))
+    k = findfirst(isequal(UInt8('\n')), mesg)
+    k === nothing && throw(YakError("missing topic in published frame"))
+    topic = String(mesg[1:k-1])
+    return topic, deleteat!(mesg, 1:k)
+end
+
+function check_topic(topic::AbstractString)
+    occursin('\n', topic) && throw(ArgumentError("topic must not contain a newline"))
+    return topic
+end
+
+# Process the messages sent by a client of the broker.
+function serve_client(broker::Broker, conn::YakConnection{TCPSocket})
+    client = BrokerClient(conn)
+    push!(broker.clients, client)
+    @async write_frames(broker, client)
+    try
+        while isopen(conn)
+            type, mesg = recv_bounded(conn, broker.maxbytes)
+            if mesg === nothing
+                reply_error(client, "message too large")
+            elseif type == 'P'
+                publish!(broker, client, mesg)
+            elseif type == 'S' || type == 'L'
+                topic = String(mesg)
+                if topic ∉ client.topics
+                    push!(client.topics, topic)
+                    push!(get!(broker.topics, topic, BrokerClient[]), client)
+                end
+                if type == 'L'
+                    push!(client.streams, topic)
+                else
+                    end_stream!(client, topic)
+                end
+            elseif type == 'U'
+                topic = String(mesg)
+                if topic ∈ client.topics
+                    delete!(client.topics, topic)
+                    end_stream!(client, topic)
+                    remove_subscriber!(broker, topic, client)
+                end
+            else
+                reply_error(client, "unexpected message type '$type'")
+            end
+        end
+    finally
+        drop_client!(broker, client)
+    end
+end
+
+# Send the queued frames to a client of the broker.
+function write_frames(broker::Broker, client::BrokerClient)
+    try
+        while true
+            while isempty(client.queue) && isempty(client.pending)
+                isopen(client.conn) || return
+                wait(client.cond)
+            end
+            isopen(client.conn) || return
+            frame = if isempty(client.queue)
+                pop!(client.latest, popfirst!(client.pending))
+            else
+                popfirst!(client.queue)
+            end
+            write(client.conn.io, frame.data)
+            flush(client.conn.io)
+            broker.delivered += 1
+        end
+    catch ex
+        drop_client!(broker, client)
+    end
+end
+
+function publish!(broker::Broker, client::BrokerClient, mesg::Vector{UInt8})
+    k = findfirst(isequal(UInt8('\n')), mesg)
+    if k === nothing
+        reply_error(client, "missing topic in published frame")
+        return
+    end
+    broker.published += 1
+    topic = String(mesg[1:k-1])
+    subscribers = get(broker.topics, topic, nothing)
+    (subscribers === nothing || isempty(subscribers)) && return
+    frame = PubFrame(topic, encode_message('P', mesg))
+    slow = nothing
+    for subscriber in subscribers
+        if !enqueue!(broker, subscriber, frame)
+            slow === nothing && (slow = BrokerClient[])
+            push!(slow, subscriber)
+        end
+    end
+    if slow !== nothing
+        for subscriber in slow
+            broker.disconnected += 1
+            drop_client!(broker, subscriber)
+        end
+    end
+end
+
+# Push a frame in the outbound queue of a subscriber applying the slow-consumer policy.
+# Return whether the subscriber is to be kept.
+function enqueue!(broker::Broker, client::BrokerClient, frame::PubFrame)
+    if frame.topic ∈ client.streams
+        # Latest-value mode: swap in the newer frame.
+        if haskey(client.latest, frame.topic)
+            broker.dropped += 1
+        else
+            push!(client.pending, frame.topic)
+            notify(client.cond)
+        end
+        client.latest[frame.topic] = frame
+        return true
+    end
+    queue = client.queue
+    if length(queue) ≥ broker.maxqueue
+        broker.policy === :disconnect && return false
+        broker.dropped += 1
+        if broker.policy === :conflate
+            i = findlast(f -> f.topic == frame.topic, queue)
+            if i !== nothing
+                queue[i] = frame
+                return true
+            end
+        end
+        popfirst!(queue)
+    end
+    push!(queue, frame)
+    notify(client.cond)
+    return true
+end
+
+# Queue an error message for a client of the broker.
+function reply_error(client::BrokerClient, mesg::AbstractString)
+    push!(client.queue, PubFrame("", encode_message('E', codeunits(mesg))))
+    notify(client.cond)
+    return
+end
+
+# Stop latest-value mode for a topic subscribed by a client.
+function end_stream!(client::BrokerClient, topic::String)
+    if topic ∈ client.streams
+        delete!(client.streams, topic)
+        if haskey(client.latest, topic)
+            delete!(client.latest, topic)
+            filter!(x -> x != topic, client.pending)
+        end
+    end
+    return
+end
+
+function remove_subscriber!(broker::Broker, topic::String, client::BrokerClient)
+    subscribers = get(broker.topics, topic, nothing)
+    subscribers === nothing && return
+    filter!(x -> x !== client, subscribers)
+    isempty(subscribers) && delete!(broker.topics, topic)
+    return
+end
+
+function drop_client!(broker::Broker, client::BrokerClient)
+    close(client.conn)
+    for topic in client.topics
+        remove_subscriber!(broker, topic, client)
+    end
+    empty!(client.topics)
+    empty!(client.queue)
+    empty!(client.streams)
+    empty!(client.latest)
+    empty!(client.pending)
+    delete!(broker.clients, client)
+    notify(client.cond)
+    return
+end
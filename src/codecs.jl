@@ -0,0 +1,151 @@
+"""
+    YakMessenger.message_type(T) -> c::Char
+
+Yield the Yak message type used to exchange values of type `T` (or vectors of such
+values) with [`YakMessenger.send_value`](@ref) and [`YakMessenger.recv_value`](@ref).
+There is no default, the schema of the exchanged messages is declared by extending this
+method for each type of plain data:
+
+    struct Status
+        code::Int32
+        flags::UInt32
+        temperature::Float64
+    end
+    YakMessenger.message_type(::Type{Status}) = 'S'
+
+Types must be plain data (`isbitstype(T)` holds) without padding bytes between or after
+their fields (which would be sent uninitialized) because values are sent as their
+in-memory bytes. The bytes of each field are sent in little-endian order, so values are
+converted on big-endian hosts.
+
+"""
+message_type(::Type{T}) where {T} = throw(ArgumentError(
+    "no Yak message type has been declared for values of type `$T`"))
+
+"""
+    YakMessenger.send_value(conn, x)
+
+Send `x`, a plain data value or a vector of such values, to the connected peer on `conn`.
+The message type is given by [`YakMessenger.message_type`](@ref) and the content is the
+bytes of `x`, no encoding is involved.
+
+See also [`YakMessenger.recv_value`](@ref).
+
+"""
+send_value(conn::YakConnection, x::T) where {T} =
+    send_parts(conn, message_type(plain_type(T)), Ref(little_endian(x)))
+
+send_value(conn::YakConnection, x::AbstractVector{T}) where {T} =
+    send_parts(conn, message_type(plain_type(T)), LITTLE_ENDIAN ? x : map(swap_bytes, x))
+
+nbytes(x::Ref{T}) where {T} = sizeof(T)
+
+"""
+    YakMessenger.recv_value(T, conn) -> x::T
+    YakMessenger.recv_value(Vector{T}, conn) -> x::Vector{T}
+    YakMessenger.recv_value(conn, (T1, T2, ...)) -> x
+
+Receive a plain data value of type `T` or a vector of such values from the connected peer
+on `conn`. The type and the size of the message are checked and the content is read
+directly into the result.
+
+With a tuple of types, the type of the result is chosen according to the message type
+among `T1`, `T2`, etc. The selection is unrolled at compile time into a sequence of
+comparisons of the message type.
+
+See also [`YakMessenger.send_value`](@ref) and [`YakMessenger.message_type`](@ref).
+
+"""
+# The types are checked before receiving the message so that an error does not leave the
+# connection in the middle of a message.
+function recv_value(::Type{T}, conn::YakConnection) where {T}
+    message_type(plain_type(elem_type(T)))
+    type, size = recv_header(conn)
+    return recv_value(T, conn, type, size)
+end
+
+function recv_value(conn::YakConnection, types::Tuple{Vararg{Type}})
+    foreach(T -> message_type(plain_type(elem_type(T))), types)
+    type, size = recv_header(conn)
+    return recv_value(conn, type, size, types...)
+end
+
+recv_value(conn::YakConnection, type::Char, size::Int, ::Type{T}, types::Type...) where {T} =
+    type == message_type(plain_type(elem_type(T))) ?
+    recv_value(T, conn, type, size) : recv_value(conn, type, size, types...)
+
+recv_value(conn::YakConnection, type::Char, size::Int) =
+    unexpected_value(conn, size, "unexpected message type '$type'")
+
+function recv_value(::Type{T}, conn::YakConnection, type::Char, size::Int) where {T}
+    type == message_type(plain_type(T)) ||
+        unexpected_value(conn, size, "unexpected message type '$type' for `$T`")
+    size == sizeof(T) ||
+        unexpected_value(conn, size, "invalid message size for `$T`")
+    ref = Ref{T}()
+    unsafe_read(conn.io, ref, sizeof(T))
+    recv_content!(conn, UInt8[]) # check final newline
+    return little_endian(ref[])
+end
+
+function recv_value(::Type{Vector{T}}, conn::YakConnection, type::Char,
+                    size::Int) where {T}
+    type == message_type(plain_type(T)) ||
+        unexpected_value(conn, size, "unexpected message type '$type' for `$T`")
+    rem(size, sizeof(T)) == 0 ||
+        unexpected_value(conn, size, "invalid message size for vector of `$T`")
+    vals = recv_content!(conn, Vector{T}(undef, div(size, sizeof(T))))
+    LITTLE_ENDIAN || map!(swap_bytes, vals, vals)
+    return vals
+end
+
+elem_type(::Type{T}) where {T} = T
+elem_type(::Type{Vector{T}}) where {T} = T
+
+function plain_type(::Type{T}) where {T}
+    isbitstype(T) || throw(ArgumentError("`$T` is not a plain data type"))
+    haspadding(T) && throw(ArgumentError("`$T` has padding bytes"))
+    return T
+end
+
+# Yield whether there are unused bytes between or after the fields of a plain data type.
+function haspadding(::Type{T}) where {T}
+    n = fieldcount(T)
+    n == 0 && return false
+    total = 0
+    for i in 1:n
+        S = fieldtype(T, i)
+        haspadding(S) && return true
+        total += sizeof(S)
+    end
+    return total != sizeof(T)
+end
+
+# Values are exchanged in little-endian byte order.
+const LITTLE_ENDIAN = ENDIAN_BOM == 0x04030201
+
+little_endian(x) = LITTLE_ENDIAN ? x : swap_bytes(x)
+
+# Reverse the byte order of each primitive field of a plain data value.
+function swap_bytes(x::T) where {T}
+    n = fieldcount(T)
+    if n == 0
+        sizeof(T) ≤ 1 && return x
+        U = sizeof(T) == 2 ? UInt16 : sizeof(T) == 4 ? UInt32 :
+            sizeof(T) == 8 ? UInt64 : UInt128
+        return reinterpret(T, bswap(reinterpret(U, x)))
+    end
+    ref = Ref(x)
+    ptr = Base.unsafe_convert(Ptr{T}, ref)
+    GC.@preserve ref for i in 1:n
+        S = fieldtype(T, i)
+        unsafe_store!(Ptr{S}(ptr + fieldoffset(T, i)), swap_bytes(getfield(x, i)))
+    end
+    return ref[]
+end
+
+# Skip the content of an unexpected message and throw an error.
+@noinline function unexpected_value(conn::YakConnection, size::Int, mesg::String)
+    skip_content(conn, size)
+    throw(YakError(mesg))
+end
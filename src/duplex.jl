@@ -0,0 +1,89 @@
+"""
+    dconn = YakMessenger.DuplexConnection(conn; maxbytes=2^26)
+
+Build a full-duplex connection on top of the Yak connection `conn` for bulk transfers.
+A background task receives the incoming messages as soon as they arrive and queues
+them, so that sending many large requests while the peer is sending large answers
+cannot deadlock with both sides blocked on writing to full socket buffers. Keyword
+`maxbytes` bounds the total size of the contents of the queued messages: when it is
+reached, the background task stops reading until some messages have been retrieved
+(a single larger message is still received). A result streamed in chunks (see
+[`YakMessenger.stream_results`](@ref)) is reassembled and queued as a single message of
+the type of its last chunk. The duplex connection takes ownership of `conn` which shall
+no longer be used directly.
+
+Messages are sent and retrieved with the usual methods:
+
+    YakMessenger.send_message(dconn, type, mesg)
+    type, mesg = YakMessenger.recv_message([T=String,] dconn)
+
+"""
+mutable struct DuplexConnection{T<:YakConnection}
+    conn::T
+    queue::Channel{Tuple{Char,Vector{UInt8}}} # received messages
+    budget::MemoryBudget # bytes of queued messages
+    error::Any # reason of the end of the reader task
+    function DuplexConnection(conn::T; maxbytes::Integer = 2^26) where {T<:YakConnection}
+        queue = Channel{Tuple{Char,Vector{UInt8}}}(typemax(Int))
+        dconn = new{T}(conn, queue, MemoryBudget(maxbytes), nothing)
+        @async read_messages(dconn)
+        return dconn
+    end
+end
+
+Base.isopen(dconn::DuplexConnection) = isopen(dconn.conn)
+Base.close(dconn::DuplexConnection) = close(dconn.conn)
+
+send_message(dconn::DuplexConnection, type::AbstractChar, mesg) =
+    send_message(dconn.conn, type, mesg)
+
+recv_message(dconn::DuplexConnection) = recv_message(String, dconn)
+
+function recv_message(::Type{String}, dconn::DuplexConnection)
+    type, mesg = recv_message(Vector{UInt8}, dconn)
+    return type, String(mesg)
+end
+
+function recv_message(::Type{Vector{UInt8}}, dconn::DuplexConnection)
+    type, mesg = try
+        take!(dconn.queue)
+    catch ex
+        ex isa InvalidStateException || rethrow(ex)
+        throw(something(dconn.error, EOFError()))
+    end
+    release!(dconn.budget, length(mesg))
+    return type, mesg
+end
+
+# Receive messages and queue them until the connection is closed. The chunks of a
+# streamed result are accounted in the budget as they arrive.
+function read_messages(dconn::DuplexConnection)
+    conn, budget = dconn.conn, dconn.budget
+    chunks = UInt8[] # chunks of a streamed result
+    try
+        while isopen(conn)
+            type, size = recv_header(conn)
+            held = length(chunks)
+            if held + size > budget.limit || !acquire!(budget, size, true)
+                # Message exceeding the limit on its own: wait for the queue to be empty.
+                while budget.used > held
+                    wait(budget.cond)
+                end
+                budget.used += size
+            end
+            mesg = recv_content!(conn, Vector{UInt8}(undef, size))
+            if type == 'K'
+                append!(chunks, mesg)
+                continue
+            elseif !isempty(chunks)
+                mesg = append!(chunks, mesg)
+                chunks = UInt8[]
+            end
+            put!(dconn.queue, (type, mesg))
+        end
+    catch ex
+        dconn.error = ex
+    finally
+        close(dconn.queue)
+    end
+end
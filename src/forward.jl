@@ -0,0 +1,90 @@
+"""
+    YakMessenger.forward_message(src, dst[, tap]; buffer) -> (type, size)
+
+Receive a message from the connection `src` and forward it unchanged to the connection
+`dst` and, if specified, to the connection `tap` (e.g., for logging). The result is the
+type and the content size of the forwarded message.
+
+Only the header of the message is parsed, the content is copied in chunks through a
+fixed size buffer, so the memory used by a relay does not grow with the size of the
+messages and the content is never stored as a whole. Keyword `buffer` may be used to
+provide the buffer (a non-empty vector of bytes) to avoid allocating one for each
+message.
+
+The destinations are locked (in a fixed order, so that relays sharing connections with
+swapped roles cannot deadlock) from the end of the header to the end of the message: a
+slow or stalled `src` thus holds them for as long and other tasks cannot send on them
+meanwhile.
+
+If receiving the header fails, `src` is closed. If receiving or forwarding the content to
+`dst` fails, `src` (which is no longer synchronized on a message boundary) and the
+destinations which may have received part of the message are closed. If forwarding to
+`tap` fails, `tap` is closed and dropped but the message is still forwarded to `dst`
+(check `isopen(tap)` to detect it).
+
+"""
+function forward_message(src::YakConnection, dst::YakConnection,
+                         tap::Union{YakConnection,Nothing} = nothing;
+                         buffer::Vector{UInt8} = Vector{UInt8}(undef, 65536))
+    type, size = recv_header(src)
+    header = message_header(type, size)
+    if tap === nothing
+        lock(dst.lock) do
+            forward_content(src, size, header, buffer, dst, nothing)
+        end
+    else
+        a, b = objectid(dst) ≤ objectid(tap) ? (dst, tap) : (tap, dst)
+        lock(a.lock) do
+            lock(b.lock) do
+                forward_content(src, size, header, buffer, dst, tap)
+            end
+        end
+    end
+    return type, size
+end
+
+function forward_content(src::YakConnection, size::Int, header::Vector{UInt8},
+                         buffer::Vector{UInt8}, dst::YakConnection,
+                         tap::Union{YakConnection,Nothing})
+    tap = write_tap(tap, header)
+    try
+        write(dst.io, header)
+        read_chunks(src, size, buffer) do chunk
+            write(dst.io, chunk)
+            tap = write_tap(tap, chunk)
+        end
+        write(dst.io, UInt8('\n'))
+        flush(dst.io)
+        dst.stamp = time()
+    catch ex
+        # Writing the header is the first thing done, so destinations may be left with a
+        # partial message whatever failed.
+        close(src)
+        close(dst)
+        tap === nothing || close(tap)
+        rethrow(ex)
+    end
+    tap = write_tap(tap, UInt8('\n'))
+    if tap !== nothing
+        try
+            flush(tap.io)
+            tap.stamp = time()
+        catch
+            close(tap)
+        end
+    end
+    return nothing
+end
+
+# Write data to the tap of a relay. A failing tap is closed and dropped: `nothing` is
+# returned so that forwarding goes on without it.
+function write_tap(tap::Union{YakConnection,Nothing}, data)
+    tap === nothing && return nothing
+    try
+        write(tap.io, data)
+        return tap
+    catch
+        close(tap)
+        return nothing
+    end
+end
@@ -0,0 +1,42 @@
+"""
+    handle = YakMessenger.store_result(conn, expr)
+
+Have the Yorick server connected by `conn` evaluate the expression `expr` and keep the
+result on the server instead of sending it. The returned `handle` is the name of the
+global variable storing the result: later requests may use it in expressions (e.g.,
+`conn("f(\$handle, 2)")`) or fetch slices of it with
+[`YakMessenger.fetch_range`](@ref), so that intermediate results of multi-step
+computations are never transferred. This is done by a message of type `V`.
+
+Stored results are subject to the storage limit and time to live set on the server by
+`yak_handle_limits`, they may be released earlier by
+[`YakMessenger.release_result`](@ref).
+
+"""
+store_result(conn::YakConnection, expr::AbstractString) = exchange(conn, 'V', expr)
+
+"""
+    YakMessenger.release_result(conn, handle)
+
+Release the result stored under `handle` by the server connected by `conn`. This is done
+by a message of type `Z`.
+
+See also [`YakMessenger.store_result`](@ref).
+
+"""
+function release_result(conn::YakConnection, handle::AbstractString)
+    exchange(conn, 'Z', handle)
+    return nothing
+end
+
+# Send a message and receive the textual answer.
+function exchange(conn::YakConnection, type::Char, mesg::AbstractString)
+    rtype, answer = lock(conn.lock) do
+        send_message(conn, type, mesg)
+        recv_message(conn)
+    end
+    rtype == 'E' && throw(YakError(answer))
+    rtype == 'B' && throw(YakError("server busy: " * answer))
+    rtype == 'R' || throw(YakError("unexpected message type '$rtype'"))
+    return answer
+end
@@ -0,0 +1,130 @@
+"""
+    h = YakMessenger.Hedger(conns; quantile=0.95, delay=0.01, nsamples=100)
+
+Build an object to send hedged requests to a pool of equivalent servers connected by
+`conns`, a vector of Yak connections. Calling `h(expr)` sends the expression `expr` to
+one of the servers and, if no answer has been received after a delay, sends a duplicate
+request to another server. The first answer is returned, the late one is discarded
+(connections are not available for other requests until their pending answer has been
+received).
+
+Hedging is only appropriate for read-only requests whose evaluation has no side effects:
+the same request may be evaluated by several servers.
+
+The hedging delay is the `quantile` of the last `nsamples` measured latencies (in
+seconds), `delay` is used as a lower bound and until enough latencies have been measured.
+
+Call `YakMessenger.hedge_stats(h)` to retrieve the number of requests, of duplicate
+requests sent (hedges), and of hedges that answered first (wins).
+
+"""
+mutable struct Hedger{T<:YakConnection}
+    conns::Vector{T}
+    quantile::Float64
+    delay::Float64           # minimal hedging delay in seconds
+    samples::Vector{Float64} # last measured latencies in seconds
+    nsamples::Int            # maximum number of latencies to remember
+    next::Int                # index of last replaced sample
+    primary::Int             # index of last chosen server
+    requests::Int            # number of requests
+    hedges::Int              # number of hedges fired
+    wins::Int                # number of hedges that answered first
+    function Hedger(conns::AbstractVector{T};
+                    quantile::Real = 0.95,
+                    delay::Real = 0.01,
+                    nsamples::Integer = 100) where {T<:YakConnection}
+        length(conns) ≥ 1 || throw(ArgumentError("at least one connection is needed"))
+        0 < quantile ≤ 1 || throw(ArgumentError("quantile must be in (0,1]"))
+        delay ≥ 0 || throw(ArgumentError("delay must be nonnegative"))
+        nsamples ≥ 1 || throw(ArgumentError("number of samples must be at least one"))
+        return new{T}(collect(conns), quantile, delay, Float64[], nsamples,
+                      0, 0, 0, 0, 0)
+    end
+end
+
+hedge_stats(h::Hedger) = (requests = h.requests, hedges = h.hedges, wins = h.wins)
+
+# Yield the current hedging delay in seconds.
+function hedge_delay(h::Hedger)
+    n = length(h.samples)
+    n < min(10, h.nsamples) && return h.delay
+    k = clamp(ceil(Int, h.quantile*n), 1, n)
+    return max(h.delay, partialsort(h.samples, k))
+end
+
+# Remember a measured latency.
+function add_sample!(h::Hedger, latency::Float64)
+    if length(h.samples) < h.nsamples
+        push!(h.samples, latency)
+    else
+        h.next = h.next < h.nsamples ? h.next + 1 : 1
+        h.samples[h.next] = latency
+    end
+    return h
+end
+
+# Choose a server among those not in `busy`, preferring an idle one.
+function choose_server(h::Hedger, busy::Integer = 0)
+    n = length(h.conns)
+    best = 0
+    for k in 1:n
+        i = mod(h.primary + k - 1, n) + 1
+        (i == busy || !isopen(h.conns[i])) && continue
+        best == 0 && (best = i)
+        if !islocked(h.conns[i].lock)
+            best = i
+            break
+        end
+    end
+    best == 0 || (h.primary = best)
+    return best
+end
+
+function (h::Hedger)(expr::AbstractString)
+    t0 = time()
+    h.requests += 1
+    chnl = Channel{Tuple{Int,Bool,Any}}(3)
+    function submit(i::Int)
+        @async try
+            put!(chnl, (i, true, h.conns[i](expr)))
+        catch ex
+            put!(chnl, (i, false, ex))
+        end
+    end
+    main = choose_server(h)
+    main == 0 && throw(YakError("no open connections"))
+    submit(main)
+    timer = Timer(hedge_delay(h)) do _
+        put!(chnl, (0, false, nothing))
+    end
+    pending = 1
+    backup = 0
+    local result
+    try
+        while true
+            i, ok, val = take!(chnl)
+            if i == 0
+                # Hedging delay expired, send a duplicate request.
+                backup = choose_server(h, main)
+                if backup != 0
+                    h.hedges += 1
+                    pending += 1
+                    submit(backup)
+                end
+                continue
+            end
+            pending -= 1
+            # An error reported by the server is a valid answer.
+            if ok || pending == 0 || val isa YakError
+                i == backup && (h.wins += 1)
+                result = (ok, val)
+                break
+            end
+        end
+    finally
+        close(timer)
+    end
+    result[1] || throw(result[2])
+    add_sample!(h, time() - t0)
+    return result[2]
+end
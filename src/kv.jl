@@ -0,0 +1,247 @@
+"""
+    kv = YakMessenger.KVServer([host,] port=0; nshards=64, maxbytes=2^26)
+
+Start an in-memory key/value Yak server listening on `port` of `host` (localhost by
+default). If `port` is 0, a free port is chosen; `kv.port` yields the actual port
+number. The server runs in background tasks until `close(kv)` is called. It is a fast
+stand-in for a Yorick server in benchmarks and tests, and may be used as a cache for
+configuration values.
+
+The server answers the following message types:
+
+- `G` to **G**et the value of the key given by the content of the message, the answer is
+  a message of type `R` with the value or of type `E` if the key does not exist;
+
+- `W` to **W**rite a value, the content of the message is the key, a newline, and the
+  value; the answer is an empty message of type `R`;
+
+- `M` to get **M**ultiple values at once, the content of the message is a list of keys
+  separated by newlines; the answer is a message of type `R` whose content is the
+  concatenation of one Yak message per key (of type `R` with the value or of type `E`
+  if the key does not exist).
+
+Clients use [`YakMessenger.kv_get`](@ref), [`YakMessenger.kv_set`](@ref), and
+[`YakMessenger.kv_mget`](@ref) to send these requests. The store may also be directly
+accessed by `kv[key]` and `kv[key] = val`.
+
+Values are stored in `nshards` (a power of 2) hash tables, each with its own lock taken
+by readers and writers for the duration of a single lookup or update, so writing a value
+takes a constant time and accesses to different shards never contend. Keys must not be
+empty nor contain a newline. Messages whose content exceeds `maxbytes` bytes are skipped
+without being stored and answered by a message of type `E`.
+
+Call `YakMessenger.kv_stats(kv)` to retrieve the number of lookups, of misses, and of
+updates.
+
+"""
+mutable struct KVServer
+    port::Int
+    shards::Vector{Dict{String,Vector{UInt8}}}
+    locks::Vector{ReentrantLock} # one lock per shard
+    gets::Threads.Atomic{Int}   # number of lookups
+    misses::Threads.Atomic{Int} # number of lookups of non-existing keys
+    sets::Threads.Atomic{Int}   # number of updates
+    maxbytes::Int               # maximum size of received messages
+    srv::YakServer
+    function KVServer(server::Sockets.TCPServer; nshards::Integer = 64,
+                      maxbytes::Integer = 2^26)
+        nshards ≥ 1 && ispow2(nshards) || throw(ArgumentError(
+            "number of shards must be a power of 2"))
+        maxbytes ≥ 0 || throw(ArgumentError("maximum message size must be nonnegative"))
+        shards = [Dict{String,Vector{UInt8}}() for i in 1:nshards]
+        locks = [ReentrantLock() for i in 1:nshards]
+        port = Int(getsockname(server)[2])
+        kv = new(port, shards, locks, Threads.Atomic{Int}(0), Threads.Atomic{Int}(0),
+                 Threads.Atomic{Int}(0), maxbytes)
+        kv.srv = serve(conn -> serve_client(kv, conn), server)
+        return kv
+    end
+end
+
+KVServer(port::Integer = 0; kwds...) = KVServer(listen(port); kwds...)
+KVServer(host::IPAddr, port::Integer; kwds...) = KVServer(listen(host, port); kwds...)
+KVServer(host::AbstractString, port::Integer; kwds...) =
+    KVServer(getaddrinfo(host), port; kwds...)
+
+Base.isopen(kv::KVServer) = isopen(kv.srv)
+Base.close(kv::KVServer) = close(kv.srv)
+
+kv_stats(kv::KVServer) = (gets = kv.gets[], misses = kv.misses[], sets = kv.sets[])
+
+shard_index(kv::KVServer, key::String) =
+    (hash(key) & (length(kv.shards) - 1)) % Int + 1
+
+function lookup(kv::KVServer, key::String)
+    Threads.atomic_add!(kv.gets, 1)
+    i = shard_index(kv, key)
+    val = lock(kv.locks[i]) do
+        get(kv.shards[i], key, nothing)
+    end
+    val === nothing && Threads.atomic_add!(kv.misses, 1)
+    return val
+end
+
+function Base.getindex(kv::KVServer, key::AbstractString)
+    val = lookup(kv, String(key))
+    val === nothing && throw(KeyError(key))
+    return val
+end
+
+Base.setindex!(kv::KVServer, val::AbstractString, key::AbstractString) =
+    setindex!(kv, Vector{UInt8}(val), key)
+
+function Base.setindex!(kv::KVServer, val::Vector{UInt8}, key::AbstractString)
+    key = String(check_key(key))
+    i = shard_index(kv, key)
+    lock(kv.locks[i]) do
+        kv.shards[i][key] = val
+    end
+    Threads.atomic_add!(kv.sets, 1)
+    return kv
+end
+
+"""
+    YakMessenger.kv_get([T = String,] conn, key) -> val::T
+
+Retrieve the value of `key` from the key/value server connected by `conn`. A `YakError`
+is thrown if the key does not exist. Optional argument `T` is the type of the result:
+`String` (the default) or `Vector{UInt8}`.
+
+See also [`YakMessenger.KVServer`](@ref).
+
+"""
+kv_get(conn::YakConnection, key::AbstractString) = kv_get(String, conn, key)
+
+function kv_get(::Type{T}, conn::YakConnection, key::AbstractString) where {T}
+    type, val = lock(conn.lock) do
+        send_message(conn, 'G', check_key(key))
+        recv_message(T, conn)
+    end
+    type == 'E' && throw(YakError(String(val)))
+    return val
+end
+
+"""
+    YakMessenger.kv_set(conn, key, val)
+
+Set the value of `key` to `val` (a string or a vector) in the key/value server connected
+by `conn`.
+
+See also [`YakMessenger.KVServer`](@ref).
+
+"""
+kv_set(conn::YakConnection, key::AbstractString, val::AbstractString) =
+    kv_set(conn, key, codeunits(val))
+
+function kv_set(conn::YakConnection, key::AbstractString,
+                val::AbstractVector{T}) where {T}
+    isconcretetype(T) || throw(ArgumentError(
+        "value must have elements of concrete type, got `$T`"))
+    type, mesg = lock(conn.lock) do
+        send_parts(conn, 'W', String(check_key(key)), UInt8('\n'), val)
+        recv_message(conn)
+    end
+    type == 'E' && throw(YakError(mesg))
+    return nothing
+end
+
+"""
+    YakMessenger.kv_mget([T = String,] conn, keys) -> vals::Vector{Union{T,Nothing}}
+
+Retrieve the values of several keys at once from the key/value server connected by
+`conn`. The result has one entry per key, the entry is `nothing` for non-existing keys.
+Optional argument `T` is the type of the values: `String` (the default) or
+`Vector{UInt8}`.
+
+See also [`YakMessenger.KVServer`](@ref).
+
+"""
+kv_mget(conn::YakConnection, keys) = kv_mget(String, conn, keys)
+
+function kv_mget(::Type{T}, conn::YakConnection, keys) where {T}
+    type, mesg = lock(conn.lock) do
+        send_message(conn, 'M', join(map(check_key, keys), '\n'))
+        recv_message(Vector{UInt8}, conn)
+    end
+    type == 'E' && throw(YakError(String(mesg)))
+    vals = Vector{Union{T,Nothing}}(undef, 0)
+    for (type, val) in decode_messages(mesg)
+        push!(vals, type == 'R' ? (T === String ? String(val) : val) : nothing)
+    end
+    return vals
+end
+
+function check_key(key::AbstractString)
+    isempty(key) && throw(ArgumentError("key must not be empty"))
+    occursin('\n', key) && throw(ArgumentError("key must not contain a newline"))
+    return key
+end
+
+# Decode a sequence of Yak messages stored in a vector of bytes.
+function decode_messages(buf::AbstractVector{UInt8})
+    list = Tuple{Char,Vector{UInt8}}[]
+    i, n = firstindex(buf), lastindex(buf)
+    while i ≤ n
+        i + 3 ≤ n && buf[i+1] == UInt8(':') || throw(YakError("malformed message"))
+        type = Char(buf[i])
+        size = 0
+        j = i + 2
+        while j ≤ n && UInt8('0') ≤ buf[j] ≤ UInt8('9')
+            size = 10*size + (Int(buf[j]) - Int('0'))
+            j += 1
+        end
+        (j > i + 2 && j ≤ n && buf[j] == UInt8('\n')) ||
+            throw(YakError("malformed message"))
+        j + size + 1 ≤ n && buf[j+size+1] == UInt8('\n') ||
+            throw(YakError("malformed message"))
+        push!(list, (type, buf[j+1:j+size]))
+        i = j + size + 2
+    end
+    return list
+end
+
+function serve_client(kv::KVServer, conn::YakConnection)
+    while isopen(conn)
+        type, mesg = recv_bounded(conn, kv.maxbytes)
+        if mesg === nothing
+            send_message(conn, 'E', "message too large")
+        elseif type == 'G'
+            val = lookup(kv, String(mesg))
+            if val === nothing
+                send_message(conn, 'E', "no such key")
+            else
+                send_message(conn, 'R', val)
+            end
+        elseif type == 'W'
+            k = findfirst(isequal(UInt8('\n')), mesg)
+            if k === nothing
+                send_message(conn, 'E', "missing value")
+            elseif k == 1
+                send_message(conn, 'E', "empty key")
+            else
+                key = String(mesg[1:k-1])
+                kv[key] = deleteat!(mesg, 1:k)
+                send_message(conn, 'R', "")
+            end
+        elseif type == 'M'
+            keys = isempty(mesg) ? String[] : split(String(mesg), '\n')
+            if any(isempty, keys)
+                # An empty list and a list of one empty key would be confused.
+                send_message(conn, 'E', "empty key")
+                continue
+            end
+            buf = IOBuffer()
+            for key in keys
+                val = lookup(kv, String(key))
+                if val === nothing
+                    write(buf, message_header('E', 11), "no such key", UInt8('\n'))
+                else
+                    write(buf, message_header('R', length(val)), val, UInt8('\n'))
+                end
+            end
+            send_message(conn, 'R', take!(buf))
+        else
+            send_message(conn, 'E', "unexpected message type '$type'")
+        end
+    end
+end
@@ -0,0 +1,112 @@
+"""
+    budget = YakMessenger.MemoryBudget(limit; parent=nothing)
+
+Build an object to account for the memory used by the buffers of received messages.
+At most `limit` bytes can be acquired from the budget. If `parent` is another budget
+(e.g., a process-wide budget shared by all connections), the memory acquired from
+`budget` is also acquired from `parent`. The number of bytes in use is given by
+`budget.used`.
+
+See also [`YakMessenger.serve_requests`](@ref).
+
+"""
+mutable struct MemoryBudget
+    limit::Int
+    used::Int
+    parent::Union{MemoryBudget,Nothing}
+    cond::Condition # to signal that memory has been released
+    function MemoryBudget(limit::Integer; parent::Union{MemoryBudget,Nothing} = nothing)
+        limit ≥ 0 || throw(ArgumentError("memory limit must be nonnegative"))
+        return new(limit, 0, parent, Condition())
+    end
+end
+
+# Yield the first budget, from `b` to its ancestors, which cannot provide `n` bytes.
+function exhausted(b::MemoryBudget, n::Int)
+    while b !== nothing
+        b.used + n > b.limit && return b
+        b = b.parent
+    end
+    return nothing
+end
+
+# Acquire `n` bytes from a budget. If the budget is exhausted and `wait` is true, block
+# until enough memory has been released; otherwise return false. A request exceeding the
+# limit of the budget (or of one of its ancestors) is never granted.
+function acquire!(b::MemoryBudget, n::Int, wait::Bool)
+    while true
+        x = exhausted(b, n)
+        x === nothing && break
+        (wait && n ≤ x.limit) || return false
+        Base.wait(x.cond)
+    end
+    while b !== nothing
+        b.used += n
+        b = b.parent
+    end
+    return true
+end
+
+# Release `n` bytes acquired from a budget.
+function release!(b::MemoryBudget, n::Int)
+    n > 0 || return
+    while b !== nothing
+        b.used -= n
+        notify(b.cond)
+        b = b.parent
+    end
+end
+
+"""
+    YakMessenger.recv_chunks(f, conn; chunksize=65536) -> type
+
+Receive a message from the connected peer on `conn` without storing its content as a
+whole: `f(type, chunk)` is called for each successive chunk of the content (of at most
+`chunksize` bytes) with `type` the message type. The chunk is a vector of bytes which is
+reused for the next chunk. The message type is returned.
+
+This is suitable for large messages whose content can be processed incrementally, the
+memory used does not depend on the size of the message.
+
+See also [`YakMessenger.recv_message`](@ref).
+
+"""
+function recv_chunks(f, conn::YakConnection; chunksize::Integer = 65536)
+    chunksize ≥ 1 || throw(ArgumentError("chunk size must be at least one"))
+    type, size = recv_header(conn)
+    read_chunks(conn, size, chunksize) do chunk
+        f(type, chunk)
+    end
+    return type
+end
+
+# Read the content of a message whose header has just been read in chunks.
+read_chunks(f, conn::YakConnection, size::Int, chunksize::Integer = 65536) =
+    read_chunks(f, conn, size, Vector{UInt8}(undef, min(size, chunksize)))
+
+function read_chunks(f, conn::YakConnection, size::Int, buf::Vector{UInt8})
+    isempty(buf) && size > 0 && throw(ArgumentError("buffer must not be empty"))
+    while size > 0
+        n = min(size, length(buf))
+        readbytes!(conn.io, buf, n) == n || throw(EOFError())
+        f(n == length(buf) ? buf : view(buf, 1:n))
+        size -= n
+    end
+    recv_content!(conn, UInt8[]) # check final newline
+    return nothing
+end
+
+# Skip the content of a message whose header has just been read.
+skip_content(conn::YakConnection, size::Int) = read_chunks(identity, conn, size)
+
+# Receive a message whose content is at most `maxbytes` long. The content of a longer
+# message is skipped without being stored (so that the stream stays in sync) and
+# `nothing` is returned in its place.
+function recv_bounded(conn::YakConnection, maxbytes::Int)
+    type, size = recv_header(conn)
+    if size > maxbytes
+        skip_content(conn, size)
+        return type, nothing
+    end
+    return type, recv_content!(conn, Vector{UInt8}(undef, size))
+end
@@ -0,0 +1,179 @@
+"""
+    YakMessenger.parse_numeric(T, mesg) -> A
+
+Parse the textual representation of a numeric scalar or array, as produced by Yorick's
+`print` (e.g., the result of `yak_to_text`), and return an array `A` of element type `T`
+and of the dimensions inferred from the nesting of the brackets. Argument `mesg` is a
+string or a vector of bytes. Yorick arrays are stored in column-major order like Julia
+arrays, so `"[[1,2,3],[4,5,6]]"` yields a 3×2 array. A scalar yields a 0-dimensional
+array.
+
+Numbers may have an exponent introduced by `e`, `E`, `d`, or `D` (e.g., `1.5d-3`).
+
+See also [`YakMessenger.parse_numeric!`](@ref).
+
+"""
+function parse_numeric(::Type{T}, mesg) where {T<:Union{Integer,AbstractFloat}}
+    buf = T[]
+    dims = parse_numeric!(buf, mesg)
+    return reshape(buf, dims)
+end
+
+"""
+    YakMessenger.parse_numeric!(buf, mesg) -> dims
+
+Parse the textual representation of a numeric scalar or array in `mesg` and store its
+values in the vector `buf` which is resized as needed. The result is the tuple of the
+inferred dimensions (empty for a scalar). Reusing the same buffer for many messages
+avoids heap allocations.
+
+See also [`YakMessenger.parse_numeric`](@ref).
+
+"""
+parse_numeric!(buf::Vector{<:Union{Integer,AbstractFloat}}, mesg::AbstractString) =
+    parse_numeric!(buf, codeunits(mesg))
+
+function parse_numeric!(buf::Vector{T},
+                        mesg::AbstractVector{UInt8}) where {T<:Union{Integer,AbstractFloat}}
+    # Separators are commas and spaces, brackets delimit sub-arrays, any other run of
+    # bytes is a number. Counts of items and dimensions are indexed by nesting depth.
+    resize!(buf, 0)
+    sizehint!(buf, count(isequal(UInt8(',')), mesg) + 1)
+    counts = Int[]
+    dims = Int[]
+    rank = -1 # unknown until the first number or closing bracket
+    depth = 0
+    i, n = firstindex(mesg), lastindex(mesg)
+    while i ≤ n
+        c = mesg[i]
+        if c == UInt8('[')
+            depth += 1
+            if rank < 0
+                push!(counts, 0)
+                push!(dims, -1)
+            elseif depth > rank
+                throw(invalid_numeric(i))
+            end
+            i += 1
+        elseif c == UInt8(']')
+            depth ≥ 1 || throw(invalid_numeric(i))
+            rank < 0 && (rank = depth)
+            k = rank - depth + 1 # index of dimension
+            if dims[k] < 0
+                dims[k] = counts[depth]
+            elseif dims[k] != counts[depth]
+                throw(invalid_numeric(i))
+            end
+            counts[depth] = 0
+            depth -= 1
+            depth ≥ 1 && (counts[depth] += 1)
+            i += 1
+        elseif c == UInt8(',') || isspace(Char(c))
+            i += 1
+        else
+            rank < 0 && (rank = depth)
+            depth == rank || throw(invalid_numeric(i))
+            j = i
+            while j < n && !isdelimiter(mesg[j+1])
+                j += 1
+            end
+            push!(buf, parse_number(T, mesg, i, j))
+            depth ≥ 1 && (counts[depth] += 1)
+            i = j + 1
+        end
+    end
+    depth == 0 || throw(invalid_numeric(n))
+    if rank ≤ 0
+        length(buf) == 1 || throw(invalid_numeric(n))
+        return ()
+    end
+    return Tuple(dims[1:rank])
+end
+
+isdelimiter(c::UInt8) =
+    c == UInt8(',') || c == UInt8('[') || c == UInt8(']') || isspace(Char(c))
+
+invalid_numeric(i::Integer) = YakError("invalid numeric array syntax at byte $i")
+
+# Exact powers of 10 as floating-point values.
+const POW10 = ntuple(k -> Float64(big(10)^(k - 1)), 23)
+
+# Parse the number in `s[i:j]`. Simple cases (at most 15 significant digits and a small
+# exponent) are computed exactly from the decimal digits, others are left to Julia's
+# parser.
+function parse_number(::Type{T}, s::AbstractVector{UInt8}, i::Int, j::Int) where {T}
+    k = i
+    neg = s[k] == UInt8('-')
+    (neg || s[k] == UInt8('+')) && (k += 1)
+    mant = 0  # significant digits
+    ndig = 0  # number of significant digits
+    e10 = 0   # decimal exponent
+    isint = true
+    saw_digit = false # at least one digit in the mantissa?
+    while k ≤ j && UInt8('0') ≤ s[k] ≤ UInt8('9')
+        d = s[k] - UInt8('0')
+        (ndig > 0 || d > 0) && (ndig += 1)
+        mant = 10*mant + d
+        saw_digit = true
+        k += 1
+    end
+    if k ≤ j && s[k] == UInt8('.')
+        isint = false
+        k += 1
+        while k ≤ j && UInt8('0') ≤ s[k] ≤ UInt8('9')
+            d = s[k] - UInt8('0')
+            (ndig > 0 || d > 0) && (ndig += 1)
+            mant = 10*mant + d
+            e10 -= 1
+            saw_digit = true
+            k += 1
+        end
+    end
+    ok = saw_digit
+    if k ≤ j && s[k] ∈ (UInt8('e'), UInt8('E'), UInt8('d'), UInt8('D'))
+        isint = false
+        k += 1
+        eneg = k ≤ j && s[k] == UInt8('-')
+        k ≤ j && (eneg || s[k] == UInt8('+')) && (k += 1)
+        ok &= k ≤ j
+        x = 0
+        while k ≤ j && UInt8('0') ≤ s[k] ≤ UInt8('9') && x < 10_000
+            x = 10*x + (s[k] - UInt8('0'))
+            k += 1
+        end
+        e10 += eneg ? -x : x
+    end
+    if ok && k > j && ndig ≤ 15
+        if T <: Integer
+            # Only exact integers in the range of `T`, others are left to the slow path.
+            val = neg ? -mant : mant
+            if T <: Base.BitInteger && isint && typemin(T) ≤ val ≤ typemax(T)
+                return convert(T, val)
+            end
+        elseif -22 ≤ e10 ≤ 22
+            val = e10 ≥ 0 ? mant*POW10[e10 + 1] : mant/POW10[1 - e10]
+            return convert(T, neg ? -val : val)
+        end
+    end
+    return parse_number_slow(T, s, i, j)
+end
+
+function parse_number_slow(::Type{T}, s::AbstractVector{UInt8}, i::Int, j::Int) where {T}
+    str = String(map(c -> c == UInt8('d') || c == UInt8('D') ? UInt8('e') : c,
+                     s[i:j]))
+    val = tryparse(T, str)
+    val === nothing || return val
+    if T <: Integer
+        # Allow integral values written as floating-point, provided they are exactly
+        # representable by `T`.
+        x = tryparse(Float64, str)
+        if x !== nothing && isinteger(x)
+            try
+                return convert(T, x)
+            catch ex
+                ex isa InexactError || rethrow()
+            end
+        end
+    end
+    throw(YakError("invalid number \"$str\""))
+end
@@ -0,0 +1,200 @@
+mutable struct ProxyClient
+    conn::YakConnection{TCPSocket}
+    replies::Channel{Tuple{Int,ReplySlot}} # numbers and slots of requests to answer
+    forwarded::Dict{Int,Tuple{AsyncConnection,Int}} # where requests have been sent
+    ProxyClient(conn::YakConnection{TCPSocket}, depth::Integer) =
+        new(conn, Channel{Tuple{Int,ReplySlot}}(depth),
+            Dict{Int,Tuple{AsyncConnection,Int}}())
+end
+
+"""
+    proxy = YakMessenger.Proxy(upstreams, [host,] port=0; key=nothing, depth=64,
+                               maxbytes=2^26)
+
+Start a load-balancing Yak proxy listening on `port` of `host` (localhost by default) in
+front of a pool of equivalent worker servers (e.g., Yorick servers which handle one
+request at a time). Argument `upstreams` is a vector of connections to the workers, the
+proxy takes ownership of these connections. If `port` is 0, a free port is chosen;
+`proxy.port` yields the actual port number. The proxy runs in background tasks until
+`close(proxy)` is called.
+
+Clients connect to the proxy as they would connect to a single server. Requests (messages
+of type `X`) are pipelined on persistent upstream connections and routed to the worker
+with the least number of outstanding requests. If keyword `key` is a function, `key(expr)`
+is called for each request expression `expr` and, unless it returns `nothing`, its
+result is a routing key and the request is routed by consistent hashing of the key: all
+requests with the same key are routed to the same worker while it is available. Answers
+are sent back to each client in the order of its requests; at most `depth` requests of a
+given client may be in flight. Cancellation messages (of type `C`) are forwarded to the
+worker processing the referenced request. Requests whose content exceeds `maxbytes` bytes
+are skipped without being stored and answered by a message of type `E`.
+
+Call `YakMessenger.proxy_stats(proxy)` to retrieve the number of forwarded requests and
+the number of outstanding requests for each worker.
+
+"""
+mutable struct Proxy
+    port::Int
+    upstreams::Vector{AsyncConnection}
+    key::Any                    # function to extract routing keys or nothing
+    ring::Vector{Tuple{UInt,Int}} # consistent hashing ring: sorted (hash, worker)
+    depth::Int
+    maxbytes::Int               # maximum size of received messages
+    clients::Set{ProxyClient}
+    requests::Int               # number of forwarded requests
+    srv::YakServer
+    function Proxy(conns::AbstractVector{<:YakConnection},
+                   server::Sockets.TCPServer;
+                   key = nothing,
+                   depth::Integer = 64,
+                   maxbytes::Integer = 2^26,
+                   vnodes::Integer = 64)
+        isempty(conns) && throw(ArgumentError("at least one upstream connection is needed"))
+        depth ≥ 1 || throw(ArgumentError("depth must be at least one"))
+        maxbytes ≥ 0 || throw(ArgumentError("maximum message size must be nonnegative"))
+        upstreams = AsyncConnection[AsyncConnection(conn) for conn in conns]
+        ring = Tuple{UInt,Int}[]
+        for i in eachindex(upstreams), v in 1:vnodes
+            push!(ring, (hash((i, v)), i))
+        end
+        sort!(ring)
+        port = Int(getsockname(server)[2])
+        proxy = new(port, upstreams, key, ring, depth, maxbytes, Set{ProxyClient}(), 0)
+        proxy.srv = serve(conn -> serve_client(proxy, conn), server)
+        return proxy
+    end
+end
+
+Proxy(conns::AbstractVector{<:YakConnection}, port::Integer = 0; kwds...) =
+    Proxy(conns, listen(port); kwds...)
+Proxy(conns::AbstractVector{<:YakConnection}, host::IPAddr, port::Integer; kwds...) =
+    Proxy(conns, listen(host, port); kwds...)
+Proxy(conns::AbstractVector{<:YakConnection}, host::AbstractString, port::Integer;
+      kwds...) = Proxy(conns, getaddrinfo(host), port; kwds...)
+
+Base.isopen(proxy::Proxy) = isopen(proxy.srv)
+
+function Base.close(proxy::Proxy)
+    close(proxy.srv)
+    for client in collect(proxy.clients)
+        close(client.replies)
+    end
+    for up in proxy.upstreams
+        close(up)
+    end
+    return nothing
+end
+
+proxy_stats(proxy::Proxy) = (requests = proxy.requests,
+                             outstanding = [length(up.pending) for up in proxy.upstreams])
+
+# Forward the requests of a client to the workers.
+function serve_client(proxy::Proxy, conn::YakConnection{TCPSocket})
+    client = ProxyClient(conn, proxy.depth)
+    push!(proxy.clients, client)
+    writer = @async write_answers(client)
+    timeout = Inf
+    urgent = false
+    nreqs = 0
+    try
+        while isopen(conn)
+            type, mesg = recv_bounded(conn, proxy.maxbytes)
+            if mesg === nothing && type ∈ ('C', 'D', 'H', 'K', 'O')
+                # Oversized control message, ignored.
+                continue
+            elseif type == 'D'
+                # Deadline for the next request, to be forwarded with it.
+                budget = tryparse(Float64, String(mesg))
+                timeout = budget === nothing ? Inf : budget
+                continue
+            elseif type == 'H'
+                # Next request has high priority, to be forwarded with it.
+                urgent = true
+                continue
+            elseif type == 'C'
+                # Cancel a request, forward to the worker.
+                n = tryparse(Int, String(mesg))
+                dest = n === nothing ? nothing : get(client.forwarded, n, nothing)
+                if dest !== nothing
+                    up, seq = dest
+                    lock(up.conn.lock) do
+                        send_message(up.conn, 'C', string(seq))
+                    end
+                end
+                continue
+            elseif type == 'K'
+                # Answers are reassembled from upstream and never streamed.
+                continue
+            elseif type == 'O'
+                # Out-of-order answers are not supported, answers come in order.
+                slot = new_slot()
+                put!(slot, ('O', Vector{UInt8}("0")))
+                put!(client.replies, (0, slot))
+                continue
+            end
+            nreqs += 1
+            slot = new_slot()
+            if mesg === nothing
+                put!(slot, ('E', Vector{UInt8}("message too large")))
+            elseif type != 'X'
+                put!(slot, ('E', Vector{UInt8}("unexpected message type '$type'")))
+            else
+                up = choose_upstream(proxy, mesg)
+                if up === nothing
+                    put!(slot, ('E', Vector{UInt8}("no available workers")))
+                else
+                    seq = submit!(up, slot, 'X', mesg; timeout=timeout, urgent=urgent)
+                    client.forwarded[nreqs] = (up, seq)
+                    proxy.requests += 1
+                end
+            end
+            put!(client.replies, (nreqs, slot))
+            timeout = Inf
+            urgent = false
+        end
+    finally
+        close(client.replies) # the writer will exit after the last answer
+        wait(writer)
+        delete!(proxy.clients, client)
+    end
+end
+
+# Send the answers to a client in the order of its requests.
+function write_answers(client::ProxyClient)
+    try
+        for (n, slot) in client.replies
+            type, mesg = take!(slot)
+            send_message(client.conn, type, mesg)
+            delete!(client.forwarded, n)
+        end
+    catch ex
+        isopen(client.conn) && @warn "proxy failed to answer client" exception=ex
+    end
+end
+
+function choose_upstream(proxy::Proxy, mesg::Vector{UInt8})
+    ups = proxy.upstreams
+    if proxy.key !== nothing
+        key = proxy.key(String(copy(mesg)))
+        if key !== nothing
+            # Consistent hashing: first worker on the ring after the hash of the key,
+            # skipping unavailable ones.
+            ring = proxy.ring
+            h = hash(key)
+            k = searchsortedfirst(ring, (h, 0))
+            for j in 0:length(ring)-1
+                i = ring[mod(k + j - 1, length(ring)) + 1][2]
+                isopen(ups[i]) && return ups[i]
+            end
+            return nothing
+        end
+    end
+    # Least outstanding requests.
+    best = nothing
+    for up in ups
+        if isopen(up) && (best === nothing || length(up.pending) < length(best.pending))
+            best = up
+        end
+    end
+    return best
+end
@@ -0,0 +1,138 @@
+# Element types of the arrays sent by Yorick servers indexed by type name and element size
+# (the size of a `long` depends on the data model of the server).
+const ARRAY_TYPES = Dict(("char", 1)     => UInt8,
+                         ("short", 2)    => Int16,
+                         ("int", 4)      => Int32,
+                         ("long", 4)     => Int32,
+                         ("long", 8)     => Int64,
+                         ("float", 4)    => Float32,
+                         ("double", 8)   => Float64,
+                         ("complex", 16) => ComplexF64)
+
+"""
+    A = YakMessenger.fetch_range(conn, name, inds...)
+
+Fetch the slice `name[inds...]` of the global numeric array `name` stored by the Yorick
+server connected by `conn`. Each index in `inds` is an integer or a range with a
+positive step, there must be one index per dimension of the array. The slice is sent as
+raw binary values in a message of type `A` without being formatted as text, so this is
+much faster than evaluating a slicing expression. Singleton dimensions are kept in the
+result. The answer describes the type name, the size in bytes, and the byte order of the
+elements, so servers with another data model or byte order are supported.
+
+The dimensions of the remote array can be retrieved by:
+
+    dims = Tuple(YakMessenger.parse_numeric(Int, conn("dimsof(\$name)"))[2:end])
+
+See also [`YakMessenger.tiles`](@ref) to iterate over a large array by tiles.
+
+"""
+function fetch_range(conn::YakConnection, name::AbstractString, inds...)
+    mesg = range_request(name, inds)
+    type, data = lock(conn.lock) do
+        send_message(conn, 'F', mesg)
+        recv_message(Vector{UInt8}, conn)
+    end
+    return decode_array(type, data)
+end
+
+# Yield the content of a message of type `F` to fetch a slice of a remote array.
+function range_request(name::AbstractString, inds::Tuple)
+    io = IOBuffer()
+    print(io, name)
+    for r in inds
+        r isa Integer && (r = r:r)
+        r isa AbstractRange{<:Integer} && step(r) > 0 && !isempty(r) ||
+            throw(ArgumentError(
+                "indices must be integers or non-empty ranges with a positive step"))
+        print(io, ' ', first(r), ' ', last(r), ' ', step(r))
+    end
+    return String(take!(io))
+end
+
+# Decode an answer to a message of type `F`. Its content is a line with the type name,
+# the size in bytes and the byte order (`L` for little-endian, `B` for big-endian) of the
+# elements and the dimensions (e.g., "double 8 L 100 50"), followed by the raw values.
+function decode_array(type::Char, mesg::Vector{UInt8})
+    type == TIMEOUT && throw(YakError("no answer before timeout"))
+    type == 'E' && throw(YakError(String(mesg)))
+    type == 'B' && throw(YakError("server busy: " * String(mesg)))
+    type == 'C' && throw(YakError("request cancelled"))
+    type == 'A' || throw(YakError("unexpected message type '$type'"))
+    i = findfirst(isequal(UInt8('\n')), mesg)
+    i === nothing && throw(YakError("missing array description"))
+    desc = split(String(mesg[1:i-1]))
+    length(desc) ≥ 3 && desc[3] ∈ ("L", "B") ||
+        throw(YakError("invalid array description \"$(join(desc, ' '))\""))
+    esize = tryparse(Int, desc[2])
+    T = esize === nothing ? nothing : get(ARRAY_TYPES, (desc[1], esize), nothing)
+    T === nothing && throw(YakError("unknown array type in \"$(join(desc, ' '))\""))
+    dims = Int[]
+    for x in desc[4:end]
+        n = tryparse(Int, x)
+        (n === nothing || n < 0) && throw(YakError("invalid array dimension \"$x\""))
+        push!(dims, n)
+    end
+    nbytes = prod(dims)*sizeof(T)
+    length(mesg) - i == nbytes || throw(YakError("invalid array size"))
+    A = Array{T}(undef, dims...)
+    GC.@preserve A mesg unsafe_copyto!(Ptr{UInt8}(pointer(A)), pointer(mesg, i + 1), nbytes)
+    (desc[3] == "L") == LITTLE_ENDIAN || map!(swap_bytes, A, A)
+    return A
+end
+
+"""
+    YakMessenger.tiles(aconn, name, dims, tilesize)
+
+Yield an iterator over the tiles of size `tilesize` (a tuple of integers, tiles at the
+edges may be smaller) of the global numeric array `name` of dimensions `dims` stored by
+the Yorick server on the asynchronous connection `aconn`. Each iteration yields a tuple
+`(inds, A)` with `inds` the ranges of the tile in the remote array and `A` the values of
+the tile:
+
+    for (inds, A) in YakMessenger.tiles(aconn, "img", (4096, 4096), (512, 512))
+        ... # process tile
+    end
+
+The request for the next tile is sent before the current tile is returned so that the
+next tile is being transferred while the current one is processed.
+
+See also [`YakMessenger.fetch_range`](@ref).
+
+"""
+tiles(aconn::AsyncConnection, name::AbstractString, dims::NTuple{N,Integer},
+      tilesize::NTuple{N,Integer}) where {N} =
+    RemoteTiles{N}(aconn, String(name), Int.(dims), Int.(tilesize))
+
+struct RemoteTiles{N}
+    aconn::AsyncConnection
+    name::String
+    dims::NTuple{N,Int}
+    tilesize::NTuple{N,Int}
+    function RemoteTiles{N}(aconn, name, dims, tilesize) where {N}
+        all(tilesize .≥ 1) || throw(ArgumentError("tile size must be at least one"))
+        return new{N}(aconn, name, dims, tilesize)
+    end
+end
+
+Base.length(t::RemoteTiles) = prod(cld.(t.dims, t.tilesize))
+Base.eltype(::Type{RemoteTiles{N}}) where {N} = Tuple{NTuple{N,UnitRange{Int}},Array}
+
+function tile_ranges(t::RemoteTiles{N}, k::Int) where {N}
+    I = CartesianIndices(cld.(t.dims, t.tilesize))[k]
+    return ntuple(d -> ((I[d] - 1)*t.tilesize[d] + 1):min(I[d]*t.tilesize[d], t.dims[d]), N)
+end
+
+function request_tile(t::RemoteTiles, k::Int)
+    slot = new_slot()
+    submit!(t.aconn, slot, 'F', range_request(t.name, tile_ranges(t, k)))
+    return slot
+end
+
+function Base.iterate(t::RemoteTiles, state = (1, nothing))
+    k, slot = state
+    k > length(t) && return nothing
+    slot === nothing && (slot = request_tile(t, k))
+    next = k < length(t) ? request_tile(t, k + 1) : nothing # prefetch next tile
+    return (tile_ranges(t, k), decode_array(take!(slot)...)), (k + 1, next)
+end
@@ -0,0 +1,461 @@
+# Token bucket for rate limiting.
+mutable struct TokenBucket
+    rate::Float64   # tokens per second
+    burst::Float64  # maximum number of tokens
+    tokens::Float64 # current number of tokens
+    time::Float64   # time of last update
+    TokenBucket(rate::Real, burst::Real) = new(rate, burst, burst, time())
+end
+
+# Refill the bucket and return whether a token is available.
+function refill!(b::TokenBucket, t::Float64)
+    b.tokens = min(b.burst, b.tokens + (t - b.time)*b.rate)
+    b.time = t
+    return b.tokens ≥ 1
+end
+
+# A pending request.
+mutable struct Job
+    type::Char
+    mesg::Vector{UInt8}
+    urgent::Bool      # high priority request?
+    deadline::Float64 # time limit to start processing the request
+    seq::Int          # sequence number to process requests of same deadline in order
+    slot::ReplySlot   # where to store the answer
+    started::Bool     # processing has started?
+    cancelled::Bool   # cancellation has been requested?
+    num::Int          # request number on its connection
+    size::Int         # number of bytes taken from the memory budget
+    done::Union{Channel{Tuple{Int,Int,ReplySlot}},Nothing} # where to signal completion
+    Job(type, mesg, urgent, deadline, seq, slot) =
+        new(type, mesg, urgent, deadline, seq, slot, false, false, 0, 0, nothing)
+end
+
+# Store the answer to a job and, if the answers of its client are sent out of order,
+# signal its completion. The channel of completions is closed when the client is gone.
+function answer!(job::Job, type::Char, mesg::Vector{UInt8})
+    put!(job.slot, (type, mesg))
+    done = job.done
+    if done !== nothing && isopen(done)
+        try
+            put!(done, (job.num, job.size, job.slot))
+        catch ex
+            ex isa InvalidStateException || rethrow(ex)
+        end
+    end
+    return nothing
+end
+
+# Urgent requests first, then earliest-deadline-first order.
+Base.isless(a::Job, b::Job) =
+    a.urgent != b.urgent ? a.urgent :
+    a.deadline < b.deadline || (a.deadline == b.deadline && a.seq < b.seq)
+
+# Binary min-heap of jobs.
+function heap_push!(heap::Vector{Job}, job::Job)
+    push!(heap, job)
+    i = length(heap)
+    while i > 1
+        j = div(i, 2)
+        isless(heap[i], heap[j]) || break
+        heap[i], heap[j] = heap[j], heap[i]
+        i = j
+    end
+    return heap
+end
+
+function heap_pop!(heap::Vector{Job})
+    job = heap[1]
+    tail = pop!(heap)
+    n = length(heap)
+    if n ≥ 1
+        heap[1] = tail
+        i = 1
+        while true
+            j = 2i
+            j > n && break
+            (j < n && isless(heap[j+1], heap[j])) && (j += 1)
+            isless(heap[j], heap[i]) || break
+            heap[i], heap[j] = heap[j], heap[i]
+            i = j
+        end
+    end
+    return job
+end
+
+"""
+    srv = YakMessenger.serve_requests(f, [host,] port=0; kwds...)
+
+Start a Yak server answering the requests of its clients by calling `f(type, mesg)` with
+`type` the message type and `mesg` the message content (a vector of bytes). The result
+of `f` (a string, a vector, or `nothing` for an empty answer) is sent back to the client
+in a message of type `R`; if `f` throws an exception, an answer of type `E` with the
+error message is sent. The requests of a given client are answered in order unless the
+client has negotiated out-of-order answers (see [`YakMessenger.AsyncConnection`](@ref)):
+each answer is then sent as soon as it is ready, preceded by a message of type `I` with
+the number of the request.
+
+Requests are read as soon as they arrive and queued, `nworkers` tasks (1 by default)
+take them from the queue to call `f`. A client may attach a deadline to a request by
+sending, just before the request, a message of type `D` whose content is the time (in
+seconds, as a decimal number) allowed for the request to start being processed. Pending
+requests are processed earliest deadline first (requests without deadline come last, in
+order of arrival), and requests whose deadline has passed are not processed: they are
+answered by an error of type `E` with content `"deadline exceeded"`. Under overload, the
+server thus does not waste time on requests whose clients have given up. A request
+preceded by a message of type `H` (for **H**igh priority) is processed before all
+non-urgent pending requests; this is intended for short control commands.
+
+A client may cancel a request by sending a message of type `C` whose content is the
+number of the request on the connection (requests are numbered from 1, messages of type
+`C`, `D`, `H`, `K`, and `O` are not counted). A queued request is dropped at once; if
+the request is being processed, cancellation is cooperative: the handler `f` may call
+[`YakMessenger.iscancelled`](@ref) to check whether it should give up. In any case, the
+answer to a cancelled request is a message of type `C`.
+
+Admission control is configured by the following keywords:
+
+- `rate` and `burst` limit the messages of each client to `rate` per second with bursts
+  of at most `burst` messages (token bucket algorithm), there is no limit by default;
+
+- `limits` is a collection of pairs `type => (rate, burst)` to limit the messages of a
+  given type sent by each client;
+
+- `maxinflight` is the maximum number of requests queued or being processed;
+
+- `maxbytes` and `totalbytes` are the maximum number of bytes of the contents of the
+  requests received and not yet answered for a given client and for all clients;
+
+- `overbudget` specifies what to do with a request whose content would exceed `maxbytes`
+  or `totalbytes`: `:wait` (the default) to wait for memory to be released before
+  receiving the content (the client is then slowed down by the flow control of the
+  connection), or `:reject` to skip the content without storing it. Requests that could
+  never fit are always rejected.
+
+Keyword `idle` specifies a timeout in seconds after which idle client connections are
+closed (see [`YakMessenger.serve`](@ref)).
+
+A message exceeding a limit is not processed, the server immediately answers with a
+message of type `B` (for **B**usy). A misbehaving client flooding the server thus cannot
+starve the other clients and the server stays responsive at saturation.
+
+Call `YakMessenger.server_stats(srv)` to retrieve the number of served requests, of
+rejected requests, of requests that exceeded their deadline, of cancelled requests, of
+requests queued or being processed, of queued requests (waiting for a worker), and the
+number of bytes used by received requests.
+
+See also [`YakMessenger.serve`](@ref).
+
+"""
+mutable struct RequestServer
+    port::Int
+    handler::Any
+    rate::Float64
+    burst::Float64
+    limits::Dict{Char,Tuple{Float64,Float64}} # per type rate limits
+    maxinflight::Int
+    maxbytes::Int
+    memory::MemoryBudget # for all clients
+    overbudget::Symbol
+    queue::Vector{Job} # pending requests (a heap)
+    cond::Condition    # to signal workers that queue is not empty
+    seq::Int      # last request sequence number
+    inflight::Int # number of requests queued or being processed
+    queued::Int   # number of requests waiting for a worker
+    served::Int   # number of served requests
+    rejected::Int # number of rejected requests
+    expired::Int  # number of requests that exceeded their deadline
+    cancelled::Int # number of cancelled requests
+    srv::YakServer
+    function RequestServer(handler, server::Sockets.TCPServer;
+                           rate::Real = Inf,
+                           burst::Real = (isfinite(rate) ? max(rate, 1) : Inf),
+                           limits = (),
+                           maxinflight::Integer = typemax(Int),
+                           maxbytes::Integer = typemax(Int),
+                           totalbytes::Integer = typemax(Int),
+                           overbudget::Symbol = :wait,
+                           nworkers::Integer = 1,
+                           idle::Real = Inf)
+        rate > 0 && burst ≥ 1 || throw(ArgumentError(
+            "rate and burst must be such that rate > 0 and burst ≥ 1"))
+        maxinflight ≥ 1 || throw(ArgumentError(
+            "maximum number of requests in flight must be at least one"))
+        nworkers ≥ 1 || throw(ArgumentError("number of workers must be at least one"))
+        overbudget ∈ (:wait, :reject) || throw(ArgumentError(
+            "`overbudget` must be `:wait` or `:reject`"))
+        dict = Dict{Char,Tuple{Float64,Float64}}()
+        for (type, (r, b)) in limits
+            r > 0 && b ≥ 1 || throw(ArgumentError(
+                "rate and burst must be such that rate > 0 and burst ≥ 1"))
+            dict[type] = (r, b)
+        end
+        port = Int(getsockname(server)[2])
+        rs = new(port, handler, rate, burst, dict, maxinflight, maxbytes,
+                 MemoryBudget(totalbytes), overbudget, Job[], Condition(),
+                 0, 0, 0, 0, 0, 0, 0)
+        rs.srv = serve(conn -> serve_client(rs, conn), server; idle=idle)
+        for i in 1:nworkers
+            @async process_requests(rs)
+        end
+        return rs
+    end
+end
+
+serve_requests(f, server::Sockets.TCPServer; kwds...) = RequestServer(f, server; kwds...)
+serve_requests(f, port::Integer = 0; kwds...) = serve_requests(f, listen(port); kwds...)
+serve_requests(f, host::IPAddr, port::Integer; kwds...) =
+    serve_requests(f, listen(host, port); kwds...)
+serve_requests(f, host::AbstractString, port::Integer; kwds...) =
+    serve_requests(f, getaddrinfo(host), port; kwds...)
+
+Base.isopen(rs::RequestServer) = isopen(rs.srv)
+function Base.close(rs::RequestServer)
+    close(rs.srv)
+    notify(rs.cond) # to let workers finish
+    return nothing
+end
+
+server_stats(rs::RequestServer) = (served   = rs.served,
+                                   rejected = rs.rejected,
+                                   expired  = rs.expired,
+                                   cancelled = rs.cancelled,
+                                   inflight = rs.inflight,
+                                   queued   = rs.queued,
+                                   memory   = rs.memory.used)
+
+# Read and queue the requests of a client.
+function serve_client(rs::RequestServer, conn::YakConnection)
+    # The writer task and its channel of numbers, sizes and slots of requests to answer
+    # (in order, or in order of completion if unordered) are only created on the first
+    # request so that idle clients cost little.
+    replies = nothing
+    writer = nothing
+    unordered = false
+    jobs = Dict{Int,Job}() # jobs not yet answered indexed by request number
+    budget = MemoryBudget(rs.maxbytes; parent=rs.memory)
+    bucket = isfinite(rs.rate) ? TokenBucket(rs.rate, rs.burst) : nothing
+    buckets = Dict{Char,TokenBucket}()
+    deadline = Inf
+    urgent = false
+    nreqs = 0
+    try
+        while isopen(conn)
+            type, size = recv_header(conn)
+            if !acquire!(budget, size, rs.overbudget === :wait)
+                skip_content(conn, size)
+                if type ∉ ('C', 'D', 'H', 'K', 'O')
+                    rs.rejected += 1
+                    nreqs += 1
+                    slot = new_slot()
+                    put!(slot, ('B', Vector{UInt8}("memory budget exceeded")))
+                    writer === nothing &&
+                        ((replies, writer) = start_writer(conn, jobs, budget, unordered))
+                    conn.busy += 1
+                    put!(replies, (nreqs, 0, slot))
+                end
+                continue
+            end
+            mesg = recv_content!(conn, Vector{UInt8}(undef, size))
+            if type ∈ ('C', 'D', 'H', 'K', 'O')
+                release!(budget, size)
+            end
+            if type == 'D'
+                # Deadline for the next request.
+                secs = tryparse(Float64, String(mesg))
+                deadline = secs === nothing ? Inf : time() + secs
+                continue
+            elseif type == 'H'
+                # Next request has high priority.
+                urgent = true
+                continue
+            elseif type == 'C'
+                # Cancel a request.
+                n = tryparse(Int, String(mesg))
+                job = n === nothing ? nothing : get(jobs, n, nothing)
+                job === nothing || cancel!(rs, job)
+                continue
+            elseif type == 'K'
+                # Answers are never streamed.
+                continue
+            elseif type == 'O'
+                # Negotiation of out-of-order answers, only possible before any request.
+                if writer === nothing
+                    unordered = String(mesg) == "1"
+                    send_message(conn, 'O', unordered ? "1" : "0")
+                else
+                    slot = new_slot()
+                    put!(slot, ('O', Vector{UInt8}("0")))
+                    put!(replies, (0, 0, slot))
+                end
+                continue
+            end
+            nreqs += 1
+            slot = new_slot()
+            reason = admit(rs, bucket, buckets, type)
+            if reason !== nothing
+                rs.rejected += 1
+                release!(budget, size)
+                size = 0
+                put!(slot, ('B', Vector{UInt8}(reason)))
+            else
+                rs.inflight += 1
+                job = Job(type, mesg, urgent, deadline, rs.seq += 1, slot)
+                jobs[nreqs] = job
+                writer === nothing &&
+                    ((replies, writer) = start_writer(conn, jobs, budget, unordered))
+                if unordered
+                    job.num, job.size, job.done = nreqs, size, replies
+                end
+                heap_push!(rs.queue, job)
+                rs.queued += 1
+                notify(rs.cond)
+            end
+            writer === nothing &&
+                ((replies, writer) = start_writer(conn, jobs, budget, unordered))
+            conn.busy += 1 # the connection is not idle until the request is answered
+            (unordered && reason === nothing) || put!(replies, (nreqs, size, slot))
+            deadline = Inf
+            urgent = false
+        end
+    finally
+        # Drop the requests left unanswered: queued ones are skipped by the workers, the
+        # handlers of the others may check for cancellation. Their completion must not
+        # be signaled to the writer which exits as soon as the channel is drained.
+        for job in collect(values(jobs))
+            job.done = nothing
+            isready(job.slot) || cancel!(rs, job)
+        end
+        if writer !== nothing
+            close(replies) # the writer will exit after the last answer
+            wait(writer)
+        end
+        release!(budget, budget.used) # memory of requests left unanswered
+    end
+end
+
+# Start the task sending the answers to a client. If answers are sent out of order, the
+# workers signal completed requests on the channel which must never block them.
+function start_writer(conn::YakConnection, jobs::Dict{Int,Job}, budget::MemoryBudget,
+                      unordered::Bool)
+    replies = Channel{Tuple{Int,Int,ReplySlot}}(unordered ? typemax(Int) : 64)
+    return replies, @async write_answers(conn, replies, jobs, budget, unordered)
+end
+
+# Send the answers to a client in the order of the channel `replies`. If `unordered` is
+# true, each answer is preceded by the request number.
+function write_answers(conn::YakConnection, replies::Channel{Tuple{Int,Int,ReplySlot}},
+                       jobs::Dict{Int,Job}, budget::MemoryBudget, unordered::Bool)
+    try
+        for (n, size, slot) in replies
+            type, mesg = take!(slot)
+            delete!(jobs, n)
+            release!(budget, size)
+            unordered && send_message(conn, 'I', string(n))
+            send_message(conn, type, mesg)
+            n > 0 && (conn.busy -= 1)
+        end
+    catch ex
+        isopen(conn) && @warn "Yak server failed to answer client" exception=ex
+        close(conn)
+    end
+end
+
+# Process queued requests. A failure to process a request must not kill the worker.
+function process_requests(rs::RequestServer)
+    while isopen(rs)
+        if isempty(rs.queue)
+            wait(rs.cond)
+            continue
+        end
+        job = heap_pop!(rs.queue)
+        job.cancelled && continue # already answered
+        job.started = true
+        rs.queued -= 1
+        try
+            process_request(rs, job)
+        catch ex
+            @warn "Yak request server failed to process request" exception=ex
+        finally
+            rs.inflight -= 1
+        end
+    end
+end
+
+# Process a request and store its answer.
+function process_request(rs::RequestServer, job::Job)
+    if time() > job.deadline
+        rs.expired += 1
+        answer!(job, 'E', Vector{UInt8}("deadline exceeded"))
+    else
+        local answer, type
+        try
+            answer = task_local_storage(:yak_job, job) do
+                to_bytes(rs.handler(job.type, job.mesg))
+            end
+            type = 'R'
+        catch ex
+            answer = Vector{UInt8}(sprint(showerror, ex))
+            type = 'E'
+        end
+        rs.served += 1
+        if job.cancelled
+            type, answer = 'C', Vector{UInt8}("cancelled")
+        end
+        answer!(job, type, answer)
+    end
+    return nothing
+end
+
+# Cancel a job. A queued job is answered at once and skipped when popped from the queue.
+function cancel!(rs::RequestServer, job::Job)
+    job.cancelled && return
+    job.cancelled = true
+    rs.cancelled += 1
+    if !job.started
+        rs.inflight -= 1
+        rs.queued -= 1
+        answer!(job, 'C', Vector{UInt8}("cancelled"))
+    end
+    return
+end
+
+"""
+    YakMessenger.iscancelled() -> bool
+
+Yield whether the client has cancelled the request being processed by the calling
+request handler (see [`YakMessenger.serve_requests`](@ref)). Long computations should
+check this periodically and give up as soon as possible if it is true.
+
+"""
+function iscancelled()
+    job = get(task_local_storage(), :yak_job, nothing)
+    return job !== nothing && job.cancelled
+end
+
+to_bytes(x::Nothing) = UInt8[]
+to_bytes(x::AbstractString) = Vector{UInt8}(x)
+to_bytes(x::Vector{UInt8}) = x
+function to_bytes(x::AbstractVector{T}) where {T}
+    isbitstype(T) || throw(ArgumentError(
+        "answer must have elements of plain data type, got `$T`"))
+    return Vector{UInt8}(reinterpret(UInt8, collect(x)))
+end
+
+# Apply admission control, return `nothing` if request is admitted, the reason of the
+# rejection otherwise.
+function admit(rs::RequestServer, bucket::Union{TokenBucket,Nothing},
+               buckets::Dict{Char,TokenBucket}, type::Char)
+    rs.inflight < rs.maxinflight || return "server overloaded"
+    t = time()
+    ok = bucket === nothing || refill!(bucket, t)
+    limit = get(rs.limits, type, nothing)
+    if limit !== nothing
+        b = get!(() -> TokenBucket(limit...), buckets, type)
+        ok = refill!(b, t) & ok
+        ok && (b.tokens -= 1)
+    end
+    ok || return "rate limit exceeded"
+    bucket === nothing || (bucket.tokens -= 1)
+    return nothing
+end
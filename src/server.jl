@@ -0,0 +1,130 @@
+"""
+    srv = YakMessenger.serve(handler, [host,] port=0; idle=Inf)
+
+Start a Yak server listening on `port` of `host` (localhost by default). If `port` is 0,
+a free port is chosen; `srv.port` yields the actual port number. The server runs in
+background tasks until `close(srv)` is called.
+
+For each connected client, `handler(conn)` is called in a new task with `conn` the Yak
+connection to the client. The handler is written as ordinary blocking code, one
+connection at a time, for example:
+
+    srv = YakMessenger.serve() do conn
+        while true
+            type, mesg = YakMessenger.recv_message(conn)
+            YakMessenger.send_message(conn, 'R', uppercase(mesg))
+        end
+    end
+
+Tasks are lightweight coroutines scheduled by Julia's event loop: a task blocked on a
+read or a write of its connection yields to the other ones, so such handlers scale to
+very many connections without threads. The connection is closed when the handler
+returns or throws (the end of the connection by the peer is not reported as an error).
+
+Keyword `idle` specifies the number of seconds after which a connection with no messages
+received or sent is closed by the server. A connection whose `busy` field is positive
+(the number of requests received and not yet answered, maintained by servers answering
+in background tasks like [`YakMessenger.serve_requests`](@ref)) is never considered
+idle. Idle connections are reaped by a single task using a timer wheel, so a very large
+number of mostly idle clients costs little more than their sockets and suspended tasks.
+The number of reaped connections is given by `srv.reaped`.
+
+"""
+mutable struct YakServer
+    server::Sockets.TCPServer
+    port::Int
+    clients::Set{YakConnection{TCPSocket}}
+    idle::Float64 # idle timeout in seconds
+    wheel::Vector{Vector{YakConnection{TCPSocket}}} # timer wheel for idle reaping
+    tick::Int     # current slot of the timer wheel
+    reaped::Int   # number of reaped idle connections
+    function YakServer(handler, server::Sockets.TCPServer; idle::Real = Inf)
+        idle > 0 || throw(ArgumentError("idle timeout must be positive"))
+        port = Int(getsockname(server)[2])
+        wheel = [YakConnection{TCPSocket}[] for i in 1:(isfinite(idle) ? WHEEL_SLOTS : 0)]
+        srv = new(server, port, Set{YakConnection{TCPSocket}}(), idle, wheel, 1, 0)
+        @async accept_clients(srv, handler)
+        isfinite(idle) && @async reap_idle(srv)
+        return srv
+    end
+end
+
+const WHEEL_SLOTS = 64
+
+serve(handler, server::Sockets.TCPServer; kwds...) = YakServer(handler, server; kwds...)
+serve(handler, port::Integer = 0; kwds...) = serve(handler, listen(port); kwds...)
+serve(handler, host::IPAddr, port::Integer; kwds...) =
+    serve(handler, listen(host, port); kwds...)
+serve(handler, host::AbstractString, port::Integer; kwds...) =
+    serve(handler, getaddrinfo(host), port; kwds...)
+
+Base.isopen(srv::YakServer) = isopen(srv.server)
+
+function Base.close(srv::YakServer)
+    isopen(srv.server) && close(srv.server)
+    for conn in collect(srv.clients)
+        close(conn)
+    end
+    return nothing
+end
+
+function accept_clients(srv::YakServer, handler)
+    while isopen(srv.server)
+        sock = try
+            accept(srv.server)
+        catch ex
+            isopen(srv.server) && @warn "Yak server failed to accept client" exception=ex
+            break
+        end
+        conn = YakConnection(sock)
+        push!(srv.clients, conn)
+        isempty(srv.wheel) || schedule_reaping!(srv, conn)
+        @async run_handler(srv, handler, conn)
+    end
+end
+
+function run_handler(srv::YakServer, handler, conn::YakConnection)
+    try
+        handler(conn)
+    catch ex
+        isopen(conn) && !(ex isa EOFError) &&
+            @warn "Yak server dropping client" exception=ex
+    finally
+        close(conn)
+        delete!(srv.clients, conn)
+    end
+end
+
+# Insert a connection in the slot of the timer wheel where it is due to expire.
+function schedule_reaping!(srv::YakServer, conn::YakConnection{TCPSocket})
+    n = length(srv.wheel)
+    dt = srv.idle/n
+    k = clamp(ceil(Int, (conn.stamp + srv.idle - time())/dt), 1, n)
+    push!(srv.wheel[mod1(srv.tick + k, n)], conn)
+end
+
+# Every tick, examine the connections in the current slot of the timer wheel: closed ones
+# are forgotten, idle ones with no pending requests are closed, the others are moved to
+# the slot where they will expire given their last activity. The cost of a tick is thus
+# proportional to the number of connections that may expire, not to the total number of
+# connections.
+function reap_idle(srv::YakServer)
+    n = length(srv.wheel)
+    dt = srv.idle/n
+    while isopen(srv.server)
+        sleep(dt)
+        srv.tick = mod1(srv.tick + 1, n)
+        conns = srv.wheel[srv.tick]
+        srv.wheel[srv.tick] = similar(conns, 0)
+        now = time()
+        for conn in conns
+            isopen(conn) || continue
+            if now - conn.stamp ≥ srv.idle && conn.busy ≤ 0
+                close(conn)
+                srv.reaped += 1
+            else
+                schedule_reaping!(srv, conn)
+            end
+        end
+    end
+end
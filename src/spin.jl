@@ -0,0 +1,43 @@
+# Busy-poll the connection for at most `conn.spin` seconds until some bytes are available
+# for reading. Each `yield` lets the event loop poll the socket without blocking, so the
+# data is seen as soon as it arrives instead of after the wake-up of a sleeping thread.
+# Return whether some bytes are available; if not, the caller falls back to a blocking
+# read.
+function spin_wait(conn::YakConnection)
+    io = conn.io
+    bytesavailable(io) > 0 && return true
+    io isa Base.LibuvStream || return false
+    Base.start_reading(io)
+    limit = time_ns() + round(UInt64, conn.spin*1e9)
+    while true
+        yield()
+        bytesavailable(io) > 0 && return true
+        (isopen(io) && time_ns() < limit) || return false
+    end
+end
+
+"""
+    YakMessenger.pin_thread(cpu)
+
+Pin the calling thread to the CPU core of index `cpu` (starting at 0). This is useful
+for a thread busy-polling a connection (see keyword `spin` of
+[`YakMessenger.connect`](@ref)): a dedicated core avoids being descheduled or migrated
+while spinning. Only supported on Linux.
+
+The affinity applies to the operating system thread, not to the calling task. Since
+Julia 1.7, a task started by `Threads.@spawn` may migrate to another thread when it
+yields (which a spinning task does all the time), so `pin_thread` shall be called from a
+sticky task (the main task or a task started by `@async`, which stays on the thread of
+its parent) and the spinning connection shall only be used from such tasks.
+
+"""
+function pin_thread(cpu::Integer)
+    Sys.islinux() || throw(YakError("thread pinning is only supported on Linux"))
+    0 ≤ cpu < 1024 || throw(ArgumentError("invalid CPU index"))
+    mask = zeros(UInt64, 16) # a cpu_set_t for 1024 CPUs
+    mask[div(cpu, 64) + 1] = one(UInt64) << rem(cpu, 64)
+    status = ccall(:sched_setaffinity, Cint, (Cint, Csize_t, Ptr{UInt64}),
+                   0, sizeof(mask), mask)
+    status == 0 || throw(SystemError("sched_setaffinity"))
+    return nothing
+end
@@ -16,7 +16,12 @@
 #
 #     set answer [Yak::send $conn $expr]
 #
+# Make several servers evaluate the same expression:
+#
+#     set answers [Yak::broadcast $conns $expr ?$timeout?]
+#
 namespace eval ::Yak {
+    variable ready
     #+
     #     Yak::connect ?$host? $port -> $conn
     #
@@ -48,20 +53,131 @@ namespace eval ::Yak {
     }
 
     proc send {conn cmd} {
-        send_message $conn X $cmd
+        return [exchange $conn X $cmd]
+    }
+
+    #+
+    #     Yak::store $conn $expr -> $handle
+    #
+    # Make the server evaluate the expression `$expr` and keep the result on the server.
+    # The returned `$handle` is the name of a global variable storing the result which
+    # can be used in later expressions, so that intermediate results need not be
+    # transferred.
+    #
+    # See also `Yak::release`.
+    #
+    #-
+    proc store {conn expr} {
+        return [exchange $conn V $expr]
+    }
+
+    #+
+    #     Yak::release $conn $handle
+    #
+    # Release the result stored on the server under `$handle`.
+    #
+    # See also `Yak::store`.
+    #
+    #-
+    proc release {conn handle} {
+        exchange $conn Z $handle
+        return
+    }
+
+    # Send a message of type `$type` and receive the answer.
+    proc exchange {conn type mesg} {
+        send_message $conn $type $mesg
+        return [recv_answer $conn]
+    }
+
+    # Receive the answer to a request and return its result, an error is raised if the
+    # request failed or has been rejected.
+    proc recv_answer {conn} {
         set result [recv_message $conn]
         set type   [lindex $result 0]
         set answer [lindex $result 1]
+        while {[string equal $type K]} {
+            # Reassemble a result streamed in chunks.
+            set result [recv_message $conn]
+            set type   [lindex $result 0]
+            append answer [lindex $result 1]
+        }
         if {[string equal $type R]} {
             return $answer
         } elseif {[string equal $type E]} {
             error $answer
+        } elseif {[string equal $type B]} {
+            error "Server busy: $answer"
         } else {
             #close $conn
             error "Unexpected message type received as answer"
         }
     }
 
+    #+
+    #     Yak::broadcast $conns $expr ?$timeout? -> $answers
+    #
+    # Send the expression `$expr` to all the servers connected by `$conns` (a list of
+    # connections) and gather their answers. All requests are sent before receiving any
+    # answer so that the whole exchange takes about one round-trip time. Optional argument
+    # `$timeout` is the maximum time (in milliseconds) to wait for the answers, the
+    # default is to wait forever.
+    #
+    # The result is a list with one element per connection, each element is a list of two
+    # elements `{$status $value}` where `$status` is `ok` and `$value` is the answer in
+    # case of success, `$status` is `error` and `$value` is the error message otherwise.
+    # If the server did not answer in time, `$status` is `timeout` and `$value` is empty;
+    # such a connection is closed because it is no longer synchronized.
+    #
+    # See also `Yak::send`.
+    #
+    #-
+    proc broadcast {conns expr {timeout -1}} {
+        set status {}
+        foreach conn $conns {
+            if {[catch {send_message $conn X $expr} mesg]} {
+                lappend status [list error $mesg]
+            } else {
+                lappend status {}
+            }
+        }
+        set deadline [expr {[clock milliseconds] + $timeout}]
+        set answers {}
+        foreach conn $conns answer $status {
+            if {[llength $answer] == 0} {
+                if {$timeout >= 0 && ![wait_readable $conn \
+                                           [expr {$deadline - [clock milliseconds]}]]} {
+                    close $conn
+                    set answer [list timeout {}]
+                } elseif {[catch {recv_answer $conn} result]} {
+                    set answer [list error $result]
+                } else {
+                    set answer [list ok $result]
+                }
+            }
+            lappend answers $answer
+        }
+        return $answers
+    }
+
+    # Wait until some data can be read from `$conn` or `$ms` milliseconds have elapsed.
+    # Return whether data is available.
+    proc wait_readable {conn ms} {
+        variable ready
+        if {$ms < 0} {
+            set ms 0
+        }
+        set ready($conn) 0
+        fileevent $conn readable [list set ::Yak::ready($conn) 1]
+        set id [after $ms [list set ::Yak::ready($conn) -1]]
+        vwait ::Yak::ready($conn)
+        after cancel $id
+        fileevent $conn readable {}
+        set flag $ready($conn)
+        unset ready($conn)
+        return [expr {$flag > 0}]
+    }
+
     #+
     #     Yak::send_message $conn $type $mesg
     #
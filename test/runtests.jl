@@ -1,5 +1,759 @@
 using YakMessenger
 using Test
 
+# Start a stub server on a free port of the loopback interface answering each message by
+# `f(type, mesg)` which yields the type and the content of the answer, or `nothing` to
+# not answer.
+function stub_server(f)
+    return YakMessenger.serve() do conn
+        while true
+            type, mesg = YakMessenger.recv_message(conn)
+            answer = f(type, mesg)
+            answer === nothing || YakMessenger.send_message(conn, answer...)
+        end
+    end
+end
+
+# Yield the two ends of a connection on the loopback interface.
+function connection_pair()
+    server = YakMessenger.Sockets.listen(0)
+    port = Int(YakMessenger.Sockets.getsockname(server)[2])
+    a = YakMessenger.connect(port)
+    b = YakMessenger.YakConnection(YakMessenger.Sockets.accept(server))
+    close(server)
+    return a, b
+end
+
+# Plain data types exchanged by the typed codecs.
+struct Status
+    code::Int32
+    flags::UInt32
+    temperature::Float64
+end
+YakMessenger.message_type(::Type{Status}) = 'S'
+YakMessenger.message_type(::Type{Float64}) = 'f'
+
+struct Padded
+    a::Int8
+    b::Int64
+end
+
+# Handler of the request servers: requests are echoed except "fail" which throws and
+# "sleep secs" which waits (giving up if cancelled). Other requests are logged in the
+# order of processing.
+const processed = String[]
+function handle_request(type, mesg)
+    cmd = String(mesg)
+    if startswith(cmd, "sleep ")
+        t = time() + parse(Float64, cmd[7:end])
+        while time() < t && !YakMessenger.iscancelled()
+            sleep(0.01)
+        end
+    else
+        push!(processed, cmd)
+        cmd == "fail" && error("failure")
+    end
+    return cmd
+end
+
 @testset "YakMessenger.jl" begin
+    @testset "parse_numeric" begin
+        parse_numeric = YakMessenger.parse_numeric
+        @test parse_numeric(Float64, "2.5") == fill(2.5)
+        @test parse_numeric(Int, "[1,2,3]") == [1,2,3]
+        A = parse_numeric(Float64, "[[1,2,3],[4,5,6]]")
+        @test size(A) == (3,2)
+        @test A == [1 4; 2 5; 3 6]
+        @test parse_numeric(Float64, "[1.5e3,-2d-2,0.1,1e300]") == [1500, -0.02, 0.1, 1e300]
+        @test parse_numeric(Float32, "[[[1],[2]]]") == reshape(Float32[1,2], 1, 2, 1)
+        @test_throws YakMessenger.YakError parse_numeric(Float64, "[[1,2],[3]]")
+        @test_throws YakMessenger.YakError parse_numeric(Float64, "[1,[2]]")
+        @test_throws YakMessenger.YakError parse_numeric(Int, "[1,x]")
+        # Numbers without digits in the mantissa or the exponent.
+        for str in (".", "e5", ".e1", "+.", "-", "[1,.]", "1e", "1e+")
+            @test_throws YakMessenger.YakError parse_numeric(Float64, str)
+        end
+        # Integers must be exactly representable.
+        @test parse_numeric(Int, "[1e3,2.0,-3]") == [1000, 2, -3]
+        @test parse_numeric(UInt8, "255") == fill(0xff)
+        @test_throws YakMessenger.YakError parse_numeric(Int, "[1.5]")
+        @test_throws YakMessenger.YakError parse_numeric(Int, "1e300")
+        @test_throws YakMessenger.YakError parse_numeric(UInt8, "256")
+        @test_throws YakMessenger.YakError parse_numeric(UInt8, "-1")
+    end
+
+    @testset "recv_message_mmap" begin
+        srv = stub_server((type, mesg) -> ('R', repeat(mesg, 1000)))
+        path = tempname()
+        YakMessenger.connect(srv.port) do conn
+            YakMessenger.send_message(conn, 'X', "abc")
+            type, mesg = YakMessenger.recv_message_mmap(conn, path)
+            @test type == 'R'
+            @test mesg == codeunits(repeat("abc", 1000))
+        end
+        @test read(path, String) == repeat("abc", 1000)
+        rm(path; force=true)
+        close(srv)
+    end
+
+    @testset "Hedger" begin
+        slow = stub_server((type, mesg) -> (sleep(0.5); ('R', "slow")))
+        fast = stub_server((type, mesg) -> ('R', "fast"))
+        conns = [YakMessenger.connect(slow.port), YakMessenger.connect(fast.port)]
+        h = YakMessenger.Hedger(conns; delay=0.05)
+        # The first request goes to the slow server, the hedge to the fast one wins.
+        @test h("x") == "fast"
+        @test YakMessenger.hedge_stats(h) == (requests = 1, hedges = 1, wins = 1)
+        foreach(close, conns)
+        close(slow)
+        close(fast)
+    end
+
+    @testset "broadcast" begin
+        srvs = [stub_server((type, mesg) -> ('R', uppercase(mesg))),
+                stub_server((type, mesg) -> ('E', "failure")),
+                stub_server((type, mesg) -> nothing)]
+        conns = [YakMessenger.connect(srv.port) for srv in srvs]
+        answers = YakMessenger.broadcast(conns, "abc"; timeout=0.5)
+        @test answers[1] == "ABC"
+        @test answers[2] isa YakMessenger.YakError
+        @test answers[3] === nothing
+        foreach(close, conns)
+        foreach(close, srvs)
+    end
+
+    @testset "Broker" begin
+        broker = YakMessenger.Broker()
+        sub = YakMessenger.connect(broker.port)
+        pub = YakMessenger.connect(broker.port)
+        YakMessenger.subscribe(sub, "a")
+        sleep(0.1) # let the broker register the subscription
+        YakMessenger.publish(pub, "b", "ignored")
+        YakMessenger.publish(pub, "a", "hello")
+        topic, data = YakMessenger.recv_published(sub)
+        @test topic == "a"
+        @test String(data) == "hello"
+        YakMessenger.send_message(sub, 'Q', "")
+        @test_throws YakMessenger.YakError YakMessenger.recv_published(sub)
+        @test YakMessenger.broker_stats(broker).published == 2
+        close(sub)
+        close(pub)
+        close(broker)
+    end
+
+    @testset "Broker latest-value mode" begin
+        broker = YakMessenger.Broker()
+        sub = YakMessenger.connect(broker.port)
+        pub = YakMessenger.connect(broker.port)
+        YakMessenger.subscribe(sub, "t"; latest=true)
+        sleep(0.1) # let the broker register the subscription
+        n = 1000
+        for i in 1:n
+            YakMessenger.publish(pub, "t", string(i))
+        end
+        # Frames come in order, the newest one is always delivered, and every frame is
+        # either delivered or replaced by a newer one.
+        values = Int[]
+        while isempty(values) || values[end] != n
+            topic, data = YakMessenger.recv_published(sub)
+            push!(values, parse(Int, String(data)))
+        end
+        @test issorted(values; lt = ≤)
+        @test length(values) + YakMessenger.broker_stats(broker).dropped == n
+        close(sub)
+        close(pub)
+        close(broker)
+    end
+
+    @testset "Proxy" begin
+        w1 = stub_server((type, mesg) -> ('R', "1:" * mesg))
+        w2 = stub_server((type, mesg) -> ('R', "2:" * mesg))
+        proxy = YakMessenger.Proxy(
+            [YakMessenger.connect(w1.port), YakMessenger.connect(w2.port)];
+            key = expr -> startswith(expr, "key") ? expr : nothing)
+        YakMessenger.connect(proxy.port) do conn
+            # Requests with the same key go to the same worker.
+            a = conn("key1")
+            @test endswith(a, ":key1")
+            @test all(conn("key1") == a for i in 1:5)
+            @test endswith(conn("x"), ":x")
+            YakMessenger.send_message(conn, 'Q', "")
+            @test YakMessenger.recv_message(conn)[1] == 'E'
+        end
+        @test YakMessenger.proxy_stats(proxy).requests == 7
+        close(proxy)
+        close(w1)
+        close(w2)
+    end
+
+    @testset "KVServer" begin
+        kv = YakMessenger.KVServer(nshards=4)
+        YakMessenger.connect(kv.port) do conn
+            YakMessenger.kv_set(conn, "a", "1")
+            YakMessenger.kv_set(conn, "b", UInt8[0x00, 0x0a])
+            @test YakMessenger.kv_get(conn, "a") == "1"
+            @test YakMessenger.kv_get(Vector{UInt8}, conn, "b") == UInt8[0x00, 0x0a]
+            @test_throws YakMessenger.YakError YakMessenger.kv_get(conn, "c")
+            @test YakMessenger.kv_mget(conn, ["a", "c", "b"]) == ["1", nothing, "\0\n"]
+            @test isempty(YakMessenger.kv_mget(conn, String[]))
+            # Keys must not be empty nor contain a newline.
+            @test_throws ArgumentError YakMessenger.kv_get(conn, "a\nb")
+            @test_throws ArgumentError YakMessenger.kv_mget(conn, [""])
+            YakMessenger.send_message(conn, 'M', "a\n")
+            @test YakMessenger.recv_message(conn) == ('E', "empty key")
+            YakMessenger.send_message(conn, 'W', "\nvalue")
+            @test YakMessenger.recv_message(conn) == ('E', "empty key")
+        end
+        kv["c"] = "3"
+        @test kv["c"] == UInt8['3']
+        @test_throws KeyError kv["d"]
+        @test YakMessenger.kv_stats(kv) == (gets = 8, misses = 3, sets = 3)
+        close(kv)
+    end
+
+    @testset "recv_message! and scoped connections" begin
+        srv = stub_server((type, mesg) -> ('R', mesg))
+        buf = UInt8[]
+        conn = YakMessenger.connect(srv.port) do conn
+            for str in ("hello", "", repeat("a", 1000), "bye")
+                YakMessenger.send_message(conn, 'X', str)
+                type, mesg = YakMessenger.recv_message!(buf, conn)
+                @test type == 'R'
+                @test mesg === buf
+                @test String(copy(mesg)) == str
+            end
+            conn
+        end
+        @test !isopen(conn) # closed on exit of the do-block
+        close(srv)
+    end
+
+    @testset "AsyncConnection" begin
+        # Deadlines are not answered, "slow" is answered late.
+        srv = stub_server((type, mesg) -> type == 'D' ? nothing :
+                          mesg == "slow" ? (sleep(0.5); ('R', mesg)) : ('R', mesg))
+        aconn = YakMessenger.AsyncConnection(srv.port)
+        reqs = [YakMessenger.request(aconn, string(i)) for i in 1:100]
+        @test [fetch(req) for req in reqs] == [string(i) for i in 1:100]
+        req = YakMessenger.request(aconn, "slow"; timeout=0.1)
+        @test_throws YakMessenger.YakError fetch(req)
+        # The late answer is discarded.
+        @test aconn("next") == "next"
+        req = YakMessenger.request(aconn, "fast"; timeout=60)
+        @test fetch(req) == "fast"
+        @test !isopen(req.timer)
+        close(aconn)
+        close(srv)
+    end
+
+    @testset "send_value and recv_value" begin
+        srv = stub_server((type, mesg) -> (type, mesg))
+        YakMessenger.connect(srv.port) do conn
+            s = Status(-1, 0x12345678, 21.5)
+            YakMessenger.send_value(conn, s)
+            @test YakMessenger.recv_value(Status, conn) == s
+            v = [1.0, 2.5, -3.0]
+            YakMessenger.send_value(conn, v)
+            @test YakMessenger.recv_value(Vector{Float64}, conn) == v
+            YakMessenger.send_value(conn, 2.5)
+            @test YakMessenger.recv_value(conn, (Status, Float64)) === 2.5
+            # A message of another type is skipped.
+            YakMessenger.send_value(conn, 2.5)
+            @test_throws YakMessenger.YakError YakMessenger.recv_value(Status, conn)
+            # Undeclared types and types with padding are rejected before any I/O.
+            YakMessenger.send_value(conn, s)
+            @test_throws ArgumentError YakMessenger.recv_value(conn, (Float64, Int))
+            @test_throws ArgumentError YakMessenger.send_value(conn, Padded(1, 2))
+            @test YakMessenger.recv_value(Status, conn) == s
+        end
+        close(srv)
+    end
+
+    @testset "serve" begin
+        srv = YakMessenger.serve() do conn
+            while true
+                type, mesg = YakMessenger.recv_message(conn)
+                mesg == "block" && sleep(0.5)
+                YakMessenger.send_message(conn, 'R', uppercase(mesg))
+            end
+        end
+        c1 = YakMessenger.connect(srv.port)
+        c2 = YakMessenger.connect(srv.port)
+        # A blocked handler does not delay the other clients.
+        YakMessenger.send_message(c1, 'X', "block")
+        t0 = time()
+        @test c2("abc") == "ABC"
+        @test time() - t0 < 0.4
+        @test YakMessenger.recv_message(c1) == ('R', "BLOCK")
+        close(c1)
+        close(c2)
+        @test timedwait(() -> isempty(srv.clients), 5.0) === :ok
+        close(srv)
+        @test !isopen(srv)
+    end
+
+    @testset "serve_requests admission control" begin
+        YakError = YakMessenger.YakError
+        stats = YakMessenger.server_stats
+
+        # In order answers and errors.
+        rs = YakMessenger.serve_requests(handle_request)
+        YakMessenger.connect(rs.port) do conn
+            @test conn("hello") == "hello"
+            @test_throws YakError conn("fail")
+            @test conn("sleep 0.01") == "sleep 0.01"
+        end
+        @test stats(rs).served == 3
+        close(rs)
+
+        # Rate limits, for all requests and per message type.
+        rs = YakMessenger.serve_requests(handle_request; rate=1, burst=2,
+                                         limits=('Y' => (1, 1),))
+        YakMessenger.connect(rs.port) do conn
+            @test conn("a") == "a"
+            YakMessenger.send_message(conn, 'Y', "b")
+            YakMessenger.send_message(conn, 'Y', "c")
+            @test YakMessenger.recv_message(conn) == ('R', "b")
+            @test YakMessenger.recv_message(conn)[1] == 'B'
+            @test_throws YakError conn("d")
+        end
+        @test stats(rs).rejected == 2
+        close(rs)
+
+        # Bounded number of requests in flight, queued requests counted separately.
+        rs = YakMessenger.serve_requests(handle_request; maxinflight=2)
+        YakMessenger.connect(rs.port) do conn
+            YakMessenger.send_message(conn, 'X', "sleep 0.5") # keep the worker busy
+            sleep(0.1)
+            YakMessenger.send_message(conn, 'X', "a")
+            YakMessenger.send_message(conn, 'X', "b")
+            @test timedwait(() -> stats(rs).rejected == 1, 5.0) === :ok
+            @test stats(rs).inflight == 2
+            @test stats(rs).queued == 1
+            @test YakMessenger.recv_message(conn) == ('R', "sleep 0.5")
+            @test YakMessenger.recv_message(conn) == ('R', "a")
+            @test YakMessenger.recv_message(conn) == ('B', "server overloaded")
+        end
+        @test timedwait(() -> stats(rs).inflight == 0, 5.0) === :ok
+        @test stats(rs).queued == 0
+        close(rs)
+    end
+
+    @testset "serve_requests deadlines" begin
+        stats = YakMessenger.server_stats
+        rs = YakMessenger.serve_requests(handle_request)
+        YakMessenger.connect(rs.port) do conn
+            YakMessenger.send_message(conn, 'X', "sleep 0.5") # keep the worker busy
+            sleep(0.1)
+            empty!(processed)
+            YakMessenger.send_message(conn, 'X', "c")
+            YakMessenger.send_message(conn, 'D', "10")
+            YakMessenger.send_message(conn, 'X', "b")
+            YakMessenger.send_message(conn, 'D', "5")
+            YakMessenger.send_message(conn, 'X', "a")
+            YakMessenger.send_message(conn, 'D', "0.1")
+            YakMessenger.send_message(conn, 'X', "late")
+            # Earliest deadline first, but answers come in the order of the requests.
+            for cmd in ("sleep 0.5", "c", "b", "a")
+                @test YakMessenger.recv_message(conn) == ('R', cmd)
+            end
+            @test YakMessenger.recv_message(conn) == ('E', "deadline exceeded")
+        end
+        @test processed == ["a", "b", "c"]
+        @test stats(rs).expired == 1
+
+        # The timeout of a pipelined request is sent as its deadline.
+        aconn = YakMessenger.AsyncConnection(rs.port)
+        slow = YakMessenger.request(aconn, "sleep 0.5")
+        late = YakMessenger.request(aconn, "late"; timeout=0.1)
+        @test fetch(slow) == "sleep 0.5"
+        @test_throws YakMessenger.YakError fetch(late)
+        @test timedwait(() -> stats(rs).expired == 2, 5.0) === :ok
+        close(aconn)
+        close(rs)
+    end
+
+    @testset "serve_requests urgent requests" begin
+        rs = YakMessenger.serve_requests(handle_request)
+        YakMessenger.connect(rs.port) do conn
+            YakMessenger.send_message(conn, 'X', "sleep 0.5") # keep the worker busy
+            sleep(0.1)
+            empty!(processed)
+            YakMessenger.send_message(conn, 'D', "5")
+            YakMessenger.send_message(conn, 'X', "a")
+            YakMessenger.send_message(conn, 'X', "b")
+            YakMessenger.send_message(conn, 'H', "")
+            YakMessenger.send_message(conn, 'X', "u")
+            for cmd in ("sleep 0.5", "a", "b", "u")
+                @test YakMessenger.recv_message(conn) == ('R', cmd)
+            end
+        end
+        @test processed == ["u", "a", "b"]
+
+        # Urgent pipelined requests use a secondary connection and are processed first.
+        aconn = YakMessenger.AsyncConnection(rs.port)
+        slow = YakMessenger.request(aconn, "sleep 0.5")
+        sleep(0.1)
+        empty!(processed)
+        bulk = YakMessenger.request(aconn, "bulk")
+        urgent = YakMessenger.request(aconn, "status"; urgent=true)
+        @test fetch(urgent) == "status"
+        @test aconn.urgent !== nothing
+        @test fetch(bulk) == "bulk"
+        @test fetch(slow) == "sleep 0.5"
+        @test processed == ["status", "bulk"]
+        close(aconn)
+        close(rs)
+    end
+
+    @testset "serve_requests cancellation" begin
+        YakError = YakMessenger.YakError
+        stats = YakMessenger.server_stats
+        rs = YakMessenger.serve_requests(handle_request)
+        aconn = YakMessenger.AsyncConnection(rs.port)
+        running = YakMessenger.request(aconn, "sleep 10")
+        queued = YakMessenger.request(aconn, "queued")
+        sleep(0.1)
+        YakMessenger.cancel(queued)
+        YakMessenger.cancel(running)
+        @test_throws YakError fetch(running)
+        @test_throws YakError fetch(queued)
+        @test fetch(queued.slot)[1] == 'C'
+        @test aconn("after") == "after"
+        @test stats(rs).cancelled == 2
+        @test stats(rs).queued == 0
+        # Cancelling an answered request has no effect.
+        done = YakMessenger.request(aconn, "done")
+        @test fetch(done) == "done"
+        YakMessenger.cancel(done)
+        @test fetch(done) == "done"
+        @test aconn("last") == "last"
+        @test stats(rs).cancelled == 2
+        close(aconn)
+        close(rs)
+    end
+
+    @testset "message size limits" begin
+        YakError = YakMessenger.YakError
+        stats = YakMessenger.server_stats
+
+        # Memory budgets of the request server.
+        rs = YakMessenger.serve_requests(handle_request; maxbytes=16, overbudget=:reject)
+        YakMessenger.connect(rs.port) do conn
+            @test_throws YakError conn(repeat("x", 100))
+            @test conn("small") == "small"
+        end
+        @test stats(rs).rejected == 1
+        @test timedwait(() -> stats(rs).memory == 0, 5.0) === :ok
+        close(rs)
+
+        # Sizes which may overflow are rejected and the connection is closed.
+        srv = stub_server((type, mesg) -> ('R', mesg))
+        YakMessenger.connect(srv.port) do conn
+            write(conn.io, "X:", repeat("9", 30), "\n")
+            flush(conn.io)
+            @test_throws Exception YakMessenger.recv_message(conn)
+        end
+        close(srv)
+
+        # Oversized messages are skipped and answered by an error.
+        kv = YakMessenger.KVServer(maxbytes=16)
+        YakMessenger.connect(kv.port) do conn
+            @test_throws YakError YakMessenger.kv_set(conn, "a", repeat("x", 100))
+            YakMessenger.kv_set(conn, "a", "1")
+            @test YakMessenger.kv_get(conn, "a") == "1"
+        end
+        close(kv)
+
+        broker = YakMessenger.Broker(maxbytes=16)
+        YakMessenger.connect(broker.port) do conn
+            YakMessenger.subscribe(conn, "t")
+            YakMessenger.publish(conn, "t", repeat("x", 100))
+            @test_throws YakError YakMessenger.recv_published(conn)
+            YakMessenger.publish(conn, "t", "small")
+            @test YakMessenger.recv_published(conn) == ("t", codeunits("small"))
+        end
+        close(broker)
+
+        srv = stub_server((type, mesg) -> ('R', mesg))
+        proxy = YakMessenger.Proxy([YakMessenger.connect(srv.port)]; maxbytes=16)
+        YakMessenger.connect(proxy.port) do conn
+            @test_throws YakError conn(repeat("x", 100))
+            @test conn("small") == "small"
+        end
+        close(proxy)
+
+        # Answers exceeding the limit of an asynchronous connection.
+        aconn = YakMessenger.AsyncConnection(srv.port; maxbytes=16)
+        @test_throws YakError aconn(repeat("x", 100))
+        @test aconn("small") == "small"
+        close(aconn)
+        close(srv)
+    end
+
+    @testset "idle connections" begin
+        rs = YakMessenger.serve_requests(handle_request; idle=0.3)
+        busy = YakMessenger.connect(rs.port)
+        idle = YakMessenger.connect(rs.port)
+        @test idle("hello") == "hello"
+        YakMessenger.send_message(busy, 'X', "sleep 1")
+        # The idle connection is reaped, not the one waiting for an answer.
+        @test timedwait(() -> rs.srv.reaped == 1, 5.0) === :ok
+        @test_throws Exception YakMessenger.recv_message(idle)
+        @test YakMessenger.recv_message(busy) == ('R', "sleep 1")
+        @test rs.srv.reaped == 1
+        @test timedwait(() -> rs.srv.reaped == 2, 5.0) === :ok
+        close(busy)
+        close(idle)
+        close(rs)
+    end
+
+    @testset "spin_wait" begin
+        srv = stub_server((type, mesg) -> ('R', uppercase(mesg)))
+        YakMessenger.connect(srv.port; spin=0.01) do conn
+            @test conn.spin == 0.01
+            for i in 1:10
+                @test conn("abc$i") == "ABC$i"
+            end
+            # Nothing to read: spinning gives up after the time budget.
+            @test !YakMessenger.spin_wait(conn)
+            YakMessenger.send_message(conn, 'X', "later")
+            conn.spin = 5.0
+            @test YakMessenger.spin_wait(conn)
+            @test bytesavailable(conn.io) > 0
+            @test YakMessenger.recv_message(conn) == ('R', "LATER")
+        end
+        close(srv)
+    end
+
+    @testset "out-of-order answers" begin
+        stats = YakMessenger.server_stats
+        rs = YakMessenger.serve_requests(handle_request; nworkers=2)
+        aconn = YakMessenger.AsyncConnection(rs.port; unordered=true)
+        @test aconn.unordered
+        slow = YakMessenger.request(aconn, "sleep 0.5")
+        fast = YakMessenger.request(aconn, "fast")
+        @test fetch(fast) == "fast"
+        @test !isready(slow.slot)
+        @test fetch(slow) == "sleep 0.5"
+        close(aconn)
+        close(rs)
+
+        # Client leaving while its request is processed.
+        rs = YakMessenger.serve_requests(handle_request)
+        aconn = YakMessenger.AsyncConnection(rs.port; unordered=true)
+        req = YakMessenger.request(aconn, "sleep 0.5")
+        sleep(0.1)
+        close(aconn)
+        YakMessenger.connect(rs.port) do conn
+            @test conn("alive") == "alive"
+        end
+        @test timedwait(() -> stats(rs).inflight == 0, 5.0) === :ok
+        close(rs)
+
+        # Servers which ignore the negotiation or answer it as a request.
+        for answer in (nothing, ('E', "unexpected message type 'O'"))
+            srv = stub_server((type, mesg) -> type == 'O' ? answer : ('R', mesg))
+            aconn = YakMessenger.AsyncConnection(srv.port; unordered=true)
+            @test !aconn.unordered
+            @test aconn("a") == "a"
+            @test aconn("b") == "b"
+            close(aconn)
+            close(srv)
+        end
+    end
+
+    @testset "streamed results" begin
+        # Stub server sending the content repeated 10 times, in chunks if asked to.
+        srv = YakMessenger.serve() do conn
+            size = 0
+            while true
+                type, mesg = YakMessenger.recv_message(conn)
+                if type == 'K'
+                    size = parse(Int, mesg)
+                    continue
+                end
+                result = repeat(mesg, 10)
+                while size > 0 && length(result) > size
+                    YakMessenger.send_message(conn, 'K', result[1:size])
+                    result = result[size+1:end]
+                end
+                YakMessenger.send_message(conn, 'R', result)
+            end
+        end
+        YakMessenger.connect(srv.port) do conn
+            @test conn("abc") == repeat("abc", 10)
+            YakMessenger.stream_results(conn, 7)
+            @test conn("abc") == repeat("abc", 10)
+            chunks = String[]
+            YakMessenger.stream(chunk -> push!(chunks, String(copy(chunk))), conn, "abc")
+            @test length(chunks) == 5
+            @test all(chunk -> length(chunk) ≤ 7, chunks)
+            @test join(chunks) == repeat("abc", 10)
+            YakMessenger.stream_results(conn, 0)
+            chunks = String[]
+            YakMessenger.stream(chunk -> push!(chunks, String(copy(chunk))), conn, "abc")
+            @test chunks == [repeat("abc", 10)]
+        end
+        aconn = YakMessenger.AsyncConnection(srv.port)
+        YakMessenger.stream_results(aconn.conn, 4)
+        reqs = [YakMessenger.request(aconn, "x$i") for i in 1:3]
+        @test [fetch(req) for req in reqs] == [repeat("x$i", 10) for i in 1:3]
+        close(aconn)
+        close(srv)
+    end
+
+    @testset "array ranges" begin
+        YakError = YakMessenger.YakError
+        decode_array = YakMessenger.decode_array
+        order = ENDIAN_BOM == 0x04030201 ? "L" : "B"
+        other = order == "L" ? "B" : "L"
+        message(desc, vals) = vcat(Vector{UInt8}(desc * "\n"),
+                                   collect(reinterpret(UInt8, vec(vals))))
+        A = decode_array('A', message("double 8 $order 2 3", [1.0 3 5; 2 4 6]))
+        @test A == [1.0 3 5; 2 4 6]
+        @test decode_array('A', message("long 4 $order 2", Int32[7, 8])) == Int32[7, 8]
+        @test eltype(decode_array('A', message("long 8 $order 1", [7]))) == Int64
+        @test decode_array('A', message("short 2 $other 2", bswap.(Int16[1, 2]))) == [1, 2]
+        @test decode_array('A', message("complex 16 $other", bswap.([1.0, 2.0]))) ==
+            fill(1.0 + 2.0im)
+        @test_throws YakError decode_array('A', message("double 8 2 3", zeros(6)))
+        @test_throws YakError decode_array('A', message("double 4 $order 2", zeros(2)))
+        @test_throws YakError decode_array('A', message("double 8 $order 3", zeros(2)))
+        @test_throws YakError decode_array('E', Vector{UInt8}("no such variable"))
+
+        # Stub server answering `F` messages with slices of a local array.
+        img = reshape(collect(1.0:60.0), 3, 4, 5)
+        srv = stub_server() do type, mesg
+            tok = split(mesg)
+            r = parse.(Int, tok[2:end])
+            inds = ntuple(d -> r[3d-2]:r[3d]:r[3d-1], length(r) ÷ 3)
+            slice = img[inds...]
+            desc = join(["double", 8, order, size(slice)...], ' ')
+            return ('A', String(message(desc, slice)))
+        end
+        YakMessenger.connect(srv.port) do conn
+            @test YakMessenger.fetch_range(conn, "img", 1:3, 2, 1:2:5) == img[1:3, 2:2, 1:2:5]
+            @test_throws ArgumentError YakMessenger.fetch_range(conn, "img", 3:1, 1, 1)
+        end
+        aconn = YakMessenger.AsyncConnection(srv.port)
+        tiles = YakMessenger.tiles(aconn, "img", size(img), (2, 3, 5))
+        @test length(tiles) == 4
+        n = 0
+        for (inds, T) in tiles
+            @test T == img[inds...]
+            n += 1
+        end
+        @test n == 4
+        close(aconn)
+        close(srv)
+    end
+
+    @testset "stored results" begin
+        # Stub server storing the results of `V` messages under handles.
+        store = Dict{String,String}()
+        srv = stub_server() do type, mesg
+            if type == 'V'
+                handle = "_yak_h$(length(store) + 1)"
+                store[handle] = uppercase(mesg)
+                return ('R', handle)
+            elseif type == 'Z'
+                haskey(store, mesg) || return ('E', "no such handle")
+                delete!(store, mesg)
+                return ('R', "")
+            elseif haskey(store, mesg)
+                return ('R', store[mesg])
+            end
+            return ('E', "undefined variable")
+        end
+        YakMessenger.connect(srv.port) do conn
+            h = YakMessenger.store_result(conn, "abc")
+            @test h == "_yak_h1"
+            @test conn(h) == "ABC"
+            @test YakMessenger.release_result(conn, h) === nothing
+            @test isempty(store)
+            @test_throws YakMessenger.YakError YakMessenger.release_result(conn, h)
+            @test_throws YakMessenger.YakError conn(h)
+        end
+        close(srv)
+    end
+
+    @testset "DuplexConnection" begin
+        # Echo server, answers to messages of type `Y` are streamed in 4 chunks.
+        srv = YakMessenger.serve() do conn
+            while true
+                type, mesg = YakMessenger.recv_message(Vector{UInt8}, conn)
+                if type == 'Y'
+                    n = cld(length(mesg), 4)
+                    for k in 1:3
+                        YakMessenger.send_message(conn, 'K', mesg[(k-1)*n+1:k*n])
+                    end
+                    mesg = mesg[3n+1:end]
+                end
+                YakMessenger.send_message(conn, 'R', mesg)
+            end
+        end
+        # Many large messages are sent before reading the answers, more than the socket
+        # buffers can hold in both directions.
+        dconn = YakMessenger.DuplexConnection(YakMessenger.connect(srv.port))
+        data = [rand(UInt8, 1 << 20) for i in 1:16]
+        for (i, x) in enumerate(data)
+            YakMessenger.send_message(dconn, isodd(i) ? 'X' : 'Y', x)
+        end
+        for x in data
+            @test YakMessenger.recv_message(Vector{UInt8}, dconn) == ('R', x)
+        end
+        @test dconn.budget.used == 0
+        close(dconn)
+        @test_throws Exception YakMessenger.recv_message(dconn)
+        close(srv)
+    end
+
+    @testset "forward_message" begin
+        # Messages written on `input` are read from `src`, messages forwarded to `dst` and
+        # `tap` are read from `output` and `logger`.
+        input, src = connection_pair()
+        dst, output = connection_pair()
+        tap, logger = connection_pair()
+        data = repeat("0123456789", 10)
+        buffer = Vector{UInt8}(undef, 7)
+        YakMessenger.send_message(input, 'X', data)
+        @test YakMessenger.forward_message(src, dst, tap; buffer=buffer) == ('X', 100)
+        @test YakMessenger.recv_message(output) == ('X', data)
+        @test YakMessenger.recv_message(logger) == ('X', data)
+        YakMessenger.send_message(input, 'R', "")
+        @test YakMessenger.forward_message(src, dst) == ('R', 0)
+        @test YakMessenger.recv_message(output) == ('R', "")
+
+        # A failing tap is dropped, the message is still forwarded.
+        close(tap)
+        YakMessenger.send_message(input, 'R', "abc")
+        @test YakMessenger.forward_message(src, dst, tap) == ('R', 3)
+        @test YakMessenger.recv_message(output) == ('R', "abc")
+        @test isopen(src) && isopen(dst)
+
+        # Relays with swapped destination and tap.
+        close(logger)
+        input2, src2 = connection_pair()
+        tap, logger = connection_pair()
+        big1, big2 = repeat("a", 1 << 20), repeat("b", 1 << 20)
+        t1 = @async YakMessenger.forward_message(src, dst, tap)
+        t2 = @async YakMessenger.forward_message(src2, tap, dst)
+        w1 = @async YakMessenger.send_message(input, 'X', big1)
+        w2 = @async YakMessenger.send_message(input2, 'X', big2)
+        r1 = @async [YakMessenger.recv_message(output) for i in 1:2]
+        r2 = @async [YakMessenger.recv_message(logger) for i in 1:2]
+        @test timedwait(() -> istaskdone(r1) && istaskdone(r2), 10.0) === :ok
+        @test sort(fetch(r1)) == [('X', big1), ('X', big2)]
+        @test sort(fetch(r2)) == [('X', big1), ('X', big2)]
+
+        # A failing source closes the source and the destinations.
+        write(input.io, "X:100\nabc")
+        close(input)
+        @test_throws Exception YakMessenger.forward_message(src, dst, tap)
+        @test !isopen(src)
+        @test !isopen(dst)
+        @test !isopen(tap)
+        foreach(close, (input2, src2, output, logger))
+    end
 end
@@ -2,6 +2,9 @@ autoload, "yak.i",
     yak_shutdown,
     yak_start,
     yak_get_server_port,
+    yak_rate_limit,
+    yak_stats,
+    yak_handle_limits,
     yak_get_value,
     yak_to_text,
     yak_connect,
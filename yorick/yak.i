@@ -54,10 +54,42 @@
  * the message `"${type}:${size}\n"` is textual; the remaining part may be binary or
  * textual.
  *
- * A server only responds to messages of type `X`. Other messages are just printed.
+ * A server only responds to messages of type `X`. Other messages are just printed, except
+ * messages of type `C`, `D`, and `H` which are silently ignored: they cancel a previous
+ * request, or specify a deadline or a high priority for the next request, which are not
+ * relevant for a server evaluating requests as soon as they are received. Since the
+ * server serves its clients in turn, a client may open a second connection to send
+ * urgent commands that shall not wait behind the bulk requests of its first connection.
  *
  * A client sends messages of type `X` and receives answers of type `R` (in case of success)
- * or `E` (in case of error).
+ * or `E` (in case of error). A server may also answer with a message of type `B` (for
+ * Busy) if the request has been rejected without being evaluated because the client
+ * exceeded its rate limit (see `yak_rate_limit`).
+ *
+ * A client may send a message of type `K` whose content is a number of bytes to have the
+ * results larger than this size streamed in chunKs: such a result is sent as a sequence
+ * of messages of type `K` of at most this size followed by a message of type `R` with the
+ * last chunk; the result is the concatenation of all the chunks. Only the first chunk is
+ * sent immediately, the next ones are sent by `after` callbacks so that other clients are
+ * served in the meantime, and the result is not formatted as a single string. A size of
+ * 0 (the default) disables streaming.
+ *
+ * A client may send a message of type `F` to Fetch a slice of a global numeric array
+ * without formatting it as text. The content is the name of the variable followed by the
+ * first index, last index and step of the slice along each dimension, all separated by
+ * spaces (e.g., "img 1 100 1 201 300 2"). The answer is a message of type `A` (for Array)
+ * whose content is a line with the type name, the size in bytes and the byte order (`L`
+ * for little-endian, `B` for big-endian) of the elements, and the dimensions of the slice
+ * (e.g., "double 8 L 100 50") followed by the raw values in the native byte order of the
+ * server.
+ *
+ * A client may send a message of type `V` to evaluate an expression and keep its Value on
+ * the server: the result is stored in a global variable whose name (the handle of the
+ * result) is returned in a message of type `R`. Later requests may use the handle in
+ * expressions (e.g., "f(_yak_h3, 2)") or fetch slices of it, so that intermediate results
+ * need not be transferred. A message of type `Z` whose content is a handle releases the
+ * stored result (see `yak_handle_limits` for the storage limits and lifetime of stored
+ * results).
  *
  * Implementation notes
  * ====================
@@ -70,10 +102,34 @@
  * Calls to `sockrecv` are blocking.
  */
 
-local _yak_debug, _yak_server;
+local _yak_debug, _yak_server, _yak_stats, _yak_byte_order;
+local _yak_limit_type, _yak_limit_rate, _yak_limit_burst;
+local _yak_handle_name, _yak_handle_size, _yak_handle_expire, _yak_handle_count;
+local _yak_handle_maxbytes, _yak_handle_ttl;
+if (is_void(_yak_handle_count)) _yak_handle_count = 0;
+if (is_void(_yak_handle_maxbytes)) _yak_handle_maxbytes = 2.0^30;
+if (is_void(_yak_handle_ttl)) _yak_handle_ttl = 3600.0;
 if (is_void(_yak_debug)) _yak_debug = 1n; // do not change value in case of multiple includes
+if (is_void(_yak_stats)) _yak_stats = [0, 0]; // numbers of served and rejected requests
 _yak_server = [];
 
+func _yak_native_order(nil)
+/* DOCUMENT order = _yak_native_order();
+
+     Private function to yield the native byte order: "L" for little-endian, "B" for
+     big-endian.
+
+   SEE ALSO: _yak_send_array.
+ */
+{
+    one = 1;
+    reshape, bytes, &one, char, sizeof(one);
+    order = (bytes(1) == 1 ? "L" : "B");
+    reshape, bytes; // drop the reference to `one`
+    return order;
+}
+_yak_byte_order = _yak_native_order();
+
 func yak_shutdown
 /* DOCUMENT yak_shutdown;
 
@@ -132,6 +188,91 @@ func yak_get_server_port(void)
     }
 }
 
+func yak_rate_limit(rate, burst, type=)
+/* DOCUMENT yak_rate_limit, rate, burst;
+         or yak_rate_limit, rate, burst, type=c;
+         or yak_rate_limit;
+
+     Limit the rate of the requests sent by each client of the Yak server to `rate`
+     requests per second with bursts of at most `burst` requests (token bucket algorithm).
+     By default, `burst = max(rate, 1)`. If keyword `type` is specified, the limit only
+     applies to the requests of this type (e.g., 'X'); otherwise, it applies to all the
+     requests of the client. Several limits may be set by successive calls, a new limit
+     for the same type replaces the previous one. When called with no arguments, all
+     limits are removed. Only requests (messages of type `X`, `V`, `Z`, or `F`) are
+     limited: control messages, which are never answered, are not.
+
+     Messages exceeding a limit are not processed: the server immediately answers with a
+     message of type `B` (for Busy) so that a client flooding the server with requests
+     cannot starve the other clients.
+
+   SEE ALSO: yak_start, yak_stats.
+ */
+{
+    extern _yak_limit_type, _yak_limit_rate, _yak_limit_burst;
+    if (is_void(rate) && is_void(burst)) {
+        _yak_limit_type = _yak_limit_rate = _yak_limit_burst = [];
+        return;
+    }
+    if (is_void(burst)) {
+        burst = max(rate, 1.0);
+    }
+    if (! is_scalar(rate) || ! is_real(rate + 0.0) || rate <= 0 ||
+        ! is_scalar(burst) || ! is_real(burst + 0.0) || burst < 1) {
+        error, "rate and burst must be scalar reals, with rate > 0 and burst >= 1";
+    }
+    type = (is_void(type) ? '\0' : char(type));
+    i = (numberof(_yak_limit_type) ? where(_yak_limit_type == type) : []);
+    if (is_array(i)) {
+        _yak_limit_rate(i(1)) = rate;
+        _yak_limit_burst(i(1)) = burst;
+    } else {
+        grow, _yak_limit_type, type;
+        grow, _yak_limit_rate, double(rate);
+        grow, _yak_limit_burst, double(burst);
+    }
+}
+
+func yak_stats(void)
+/* DOCUMENT stats = yak_stats();
+
+     Return `[nserved, nrejected]` the numbers of requests served by the Yak server and of
+     messages rejected because clients exceeded their rate limits.
+
+   SEE ALSO: yak_start, yak_rate_limit.
+ */
+{
+    return _yak_stats;
+}
+
+func yak_handle_limits(maxbytes, ttl)
+/* DOCUMENT yak_handle_limits, maxbytes, ttl;
+
+     Set the limits for the results stored on the Yak server by messages of type `V`:
+     `maxbytes` is the maximum number of bytes of all the stored results (1 GiB by
+     default) and `ttl` is the time to live of a stored result in seconds (one hour by
+     default). Storing a result that would exceed `maxbytes` fails with an error, stored
+     results are released when their time to live has elapsed. Void arguments leave the
+     corresponding limit unchanged.
+
+   SEE ALSO: yak_start.
+ */
+{
+    extern _yak_handle_maxbytes, _yak_handle_ttl;
+    if (! is_void(maxbytes)) {
+        if (! is_scalar(maxbytes) || ! is_real(maxbytes + 0.0) || maxbytes < 0) {
+            error, "maximum number of bytes must be a nonnegative scalar";
+        }
+        _yak_handle_maxbytes = double(maxbytes);
+    }
+    if (! is_void(ttl)) {
+        if (! is_scalar(ttl) || ! is_real(ttl + 0.0) || ttl <= 0) {
+            error, "time to live must be a positive scalar";
+        }
+        _yak_handle_ttl = double(ttl);
+    }
+}
+
 func yak_get_value(name) { return symbol_exists(name) ? symbol_def(name) : []; }
 /* DOCUMENT val = yak_get_value(name);
 
@@ -186,14 +327,25 @@ func yak_send(sock, expr)
         error, "expression must be a scalar string";
     }
     yak_send_message, sock, 'X', expr;
-    local type;
+    local type, parts;
     str = yak_recv_message(sock, type);
+    while (type == 'K') {
+        // Chunk of a streamed result.
+        grow, parts, str;
+        str = yak_recv_message(sock, type);
+    }
     if (type == 'R') {
+        if (! is_void(parts)) {
+            str = sum(grow(parts, str));
+        }
         // Normal result.
         return str;
     } else if (type == 'E') {
         // Some error occurred.
         error, str;
+    } else if (type == 'B') {
+        // Server is busy.
+        error, "server busy: " + str;
     } else {
         // Some unexpected result.
         error, swrite("unexpected message type = %d", type);
@@ -323,41 +475,405 @@ func _yak_listen_callback(listener)
    SEE ALSO: yak_start.
  */
 {
-    sock = listener(_yak_recv_callback);
+    // State of the client for rate limiting and streaming of results.
+    state = save(tokens=0.0, time=0.0, chunk=0, scheduled=0n, sock=[], text=[]);
+    sock = listener(closure(_yak_recv_callback, state));
     yak_info, swrite(format="Client connected on port %d", sock.port);
 }
 
-func _yak_recv_callback(_yak_sock)
-/* DOCUMENT _yak_recv_callback, sock;
+func _yak_recv_callback(_yak_state, _yak_sock)
+/* DOCUMENT _yak_recv_callback, state, sock;
 
-     Private callback called to process data sent by a client.
+     Private callback called to process data sent by a client. Argument `state` is an
+     object storing the state of the client.
 
    SEE ALSO: yak_start.
  */
 {
     // IMPORTANT: All symbols must be prefixed with _yak_ to avoid collisions in
     //            evaluating code.
+    extern _yak_stats;
     local _yak_type;
     _yak_mesg = yak_recv_message(_yak_sock, _yak_type);
+    if (_yak_type != 'C' && _yak_type != 'D' && _yak_type != 'H' && _yak_type != 'K') {
+        // Finish sending the result being streamed before answering.
+        _yak_stream_flush, _yak_state;
+    }
+    if ((_yak_type == 'X' || _yak_type == 'V' || _yak_type == 'Z' || _yak_type == 'F') &&
+        ! _yak_admit(_yak_state, _yak_type)) {
+        // Fast rejection, the request is not processed. Control messages are never
+        // rejected since they are not answered.
+        _yak_stats(2) += 1;
+        _yak_err = yak_send_message(_yak_sock, 'B', "rate limit exceeded");
+        if (! is_void(_yak_err)) {
+            _yak_error, _yak_err;
+        }
+        return;
+    }
     if (_yak_type == 'X') {
+        _yak_stats(1) += 1;
         _yak_result = _yak_eval(_yak_mesg, _yak_type);
         //if (is_void(_yak_result)) {
         //    _yak_result = "";
         //} else
-        if (! is_string(_yak_result) || ! is_scalar(_yak_result)) {
+        if (_yak_type == 'R' && _yak_state.chunk > 0) {
+            // Stream the result if it is too large.
+            _yak_text = ((is_string(_yak_result) && is_scalar(_yak_result)) ?
+                         [_yak_result] : print(_yak_result));
+            if (sum(strlen(_yak_text)) > _yak_state.chunk) {
+                _yak_stream_start, _yak_state, _yak_sock, _yak_text;
+                return;
+            }
+            _yak_result = (numberof(_yak_text) == 1 ? _yak_text(1) : sum(_yak_text));
+        } else if (! is_string(_yak_result) || ! is_scalar(_yak_result)) {
             _yak_result = yak_to_text(_yak_result);
         }
         _yak_err = yak_send_message(_yak_sock, _yak_type, _yak_result);
         if (! is_void(_yak_err)) {
             _yak_error, _yak_err;
         }
+    } else if (_yak_type == 'V') {
+        _yak_stats(1) += 1;
+        _yak_result = _yak_eval(_yak_mesg, _yak_type);
+        if (_yak_type == 'R') {
+            _yak_result = _yak_store(_yak_result, _yak_type);
+        }
+        _yak_err = yak_send_message(_yak_sock, _yak_type, _yak_result);
+        if (! is_void(_yak_err)) {
+            _yak_error, _yak_err;
+        }
+    } else if (_yak_type == 'Z') {
+        _yak_stats(1) += 1;
+        _yak_result = _yak_release(_yak_mesg, _yak_type);
+        _yak_err = yak_send_message(_yak_sock, _yak_type, _yak_result);
+        if (! is_void(_yak_err)) {
+            _yak_error, _yak_err;
+        }
+    } else if (_yak_type == 'F') {
+        _yak_stats(1) += 1;
+        _yak_result = _yak_fetch(_yak_mesg, _yak_type);
+        if (_yak_type == 'A') {
+            _yak_err = _yak_send_array(_yak_sock, _yak_result);
+        } else {
+            _yak_err = yak_send_message(_yak_sock, _yak_type, _yak_result);
+        }
+        if (! is_void(_yak_err)) {
+            _yak_error, _yak_err;
+        }
     } else if (_yak_type == 'E') {
         _yak_error, _yak_mesg;
+    } else if (_yak_type == 'K') {
+        // Maximum size of the chunks of streamed results.
+        _yak_size = 0;
+        if (sread(_yak_mesg, _yak_size) != 1 || _yak_size < 0) {
+            _yak_size = 0;
+        }
+        save, _yak_state, chunk=_yak_size;
+    } else if (_yak_type == 'C' || _yak_type == 'D' || _yak_type == 'H') {
+        // Cancellation of previous request, deadline or priority of next request, not
+        // relevant as requests are not queued.
+    } else if (_yak_type == 'O') {
+        // Requests are answered in order, out-of-order answers are not supported.
+        _yak_err = yak_send_message(_yak_sock, 'O', "0");
+        if (! is_void(_yak_err)) {
+            _yak_error, _yak_err;
+        }
     } else {
         write, format="YAK INFO (%c): %s\n", _yak_type, _yak_mesg;
     }
 }
 
+func _yak_store(value, &type)
+/* DOCUMENT handle = _yak_store(value, type);
+
+     Private function to store `value` under a new handle which is returned. Caller's
+     variable `type` is set to 'E' and the error message is returned if the storage
+     limit would be exceeded.
+
+   SEE ALSO: _yak_release, yak_handle_limits.
+ */
+{
+    extern _yak_handle_name, _yak_handle_size, _yak_handle_expire, _yak_handle_count;
+    now = _yak_handle_purge();
+    size = sizeof(value);
+    used = (numberof(_yak_handle_size) ? sum(_yak_handle_size) : 0);
+    if (used + size > _yak_handle_maxbytes) {
+        type = 'E';
+        return "result storage limit exceeded";
+    }
+    handle = swrite(format="_yak_h%d", ++_yak_handle_count);
+    symbol_set, handle, value;
+    grow, _yak_handle_name, handle;
+    grow, _yak_handle_size, size;
+    grow, _yak_handle_expire, now + _yak_handle_ttl;
+    type = 'R';
+    return handle;
+}
+
+func _yak_release(handle, &type)
+/* DOCUMENT mesg = _yak_release(handle, type);
+
+     Private function to release the result stored under `handle`. Caller's variable
+     `type` is set to 'R' and an empty string is returned on success, to 'E' and the
+     error message is returned if there is no such handle.
+
+   SEE ALSO: _yak_store.
+ */
+{
+    extern _yak_handle_name, _yak_handle_size, _yak_handle_expire;
+    _yak_handle_purge;
+    keep = (numberof(_yak_handle_name) ? (_yak_handle_name != handle) : []);
+    if (is_void(keep) || allof(keep)) {
+        type = 'E';
+        return "unknown handle `" + handle + "`";
+    }
+    symbol_set, handle, [];
+    _yak_handle_keep, keep;
+    type = 'R';
+    return "";
+}
+
+func _yak_handle_purge(void)
+/* DOCUMENT now = _yak_handle_purge();
+
+     Private function to release the stored results whose time to live has elapsed.
+     The current wall time is returned.
+
+   SEE ALSO: _yak_store.
+ */
+{
+    now = array(double, 3);
+    timer, now;
+    now = now(3); // wall time
+    if (numberof(_yak_handle_expire) && min(_yak_handle_expire) <= now) {
+        keep = (_yak_handle_expire > now);
+        for (i = 1; i <= numberof(keep); ++i) {
+            if (! keep(i)) {
+                symbol_set, _yak_handle_name(i), [];
+            }
+        }
+        _yak_handle_keep, keep;
+    }
+    return now;
+}
+
+func _yak_handle_keep(keep)
+{
+    extern _yak_handle_name, _yak_handle_size, _yak_handle_expire;
+    j = where(keep);
+    if (is_array(j)) {
+        _yak_handle_name = _yak_handle_name(j);
+        _yak_handle_size = _yak_handle_size(j);
+        _yak_handle_expire = _yak_handle_expire(j);
+    } else {
+        _yak_handle_name = _yak_handle_size = _yak_handle_expire = [];
+    }
+}
+
+func _yak_fetch(mesg, &type)
+/* DOCUMENT arr = _yak_fetch(mesg, type);
+
+     Private function to extract the slice of a global array specified by the content
+     `mesg` of a message of type `F`. Caller's variable `type` is set to 'A' on success
+     and to 'E' on error, the result is then the error message.
+
+   SEE ALSO: _yak_send_array.
+ */
+{
+    type = 'E';
+    if (catch(-1)) {
+        return catch_message;
+    }
+    tok = strtok(mesg);
+    x = yak_get_value(tok(1));
+    if (! is_array(x) || identof(x) > Y_COMPLEX) {
+        return "`" + tok(1) + "` is not a numeric array";
+    }
+    dims = dimsof(x);
+    rank = dims(1);
+    r = array(long, 3*rank + 1); // one more to detect extra values
+    if (sread(tok(2), r) != 3*rank) {
+        return swrite(format="expecting %d ranges", rank);
+    }
+    if (rank > 0) {
+        first = r(1:-2:3);
+        last = r(2:-1:3);
+        step = r(3:0:3);
+        if (anyof(step < 1) || anyof(first < 1) || anyof(first > last) ||
+            anyof(last > dims(2:0))) {
+            return "invalid ranges";
+        }
+    }
+    type = 'A';
+    if (rank == 0) return x;
+    /* Linear (0-based) indices of the slice, the first dimension varying fastest, so that
+       any rank is supported. */
+    idx = [0];
+    stride = 1;
+    sdims = [rank];
+    for (d = 1; d <= rank; ++d) {
+        i = stride*(indgen(first(d):last(d):step(d)) - 1);
+        m = numberof(idx);
+        n = numberof(i);
+        idx = (idx(,-:1:n) + i(-:1:m,))(*);
+        stride *= dims(d + 1);
+        grow, sdims, n;
+    }
+    arr = array(structof(x), sdims);
+    arr(*) = x(*)(idx + 1);
+    return arr;
+}
+
+func _yak_send_array(sock, arr)
+/* DOCUMENT err = _yak_send_array(sock, arr);
+
+     Private function to send the numeric array `arr` to the peer on socket `sock` in a
+     message of type `A`. The content of the message is a line with the type name, the
+     size and the byte order of the elements, and the dimensions of `arr` followed by its
+     raw values. A void result is returned on success, an error message is returned on
+     error.
+
+   SEE ALSO: _yak_fetch, yak_send_message.
+ */
+{
+    dims = dimsof(arr);
+    desc = typeof(arr) + swrite(format=" %d %s", sizeof(structof(arr)), _yak_byte_order);
+    if (dims(1) > 0) {
+        desc += sum(swrite(format=" %d", dims(2:0)));
+    }
+    desc = strchar(desc + "\n")(1:-1); // drop final null
+    head = strchar(swrite(format="A:%d\n", numberof(desc) + sizeof(arr)))(1:-1);
+    if (socksend(sock, head) != sizeof(head) || socksend(sock, desc) != sizeof(desc) ||
+        socksend(sock, arr) != sizeof(arr) || socksend(sock, ['\n']) != 1) {
+        close, sock;
+        return "failed to send array";
+    }
+}
+
+func _yak_stream_start(state, sock, text)
+/* DOCUMENT _yak_stream_start, state, sock, text;
+
+     Private subroutine to start streaming a result to the client on socket `sock` whose
+     state is stored in object `state`. The result is the concatenation of the strings
+     in `text`. The first chunk is sent immediately, the others by `after` callbacks.
+
+   SEE ALSO: _yak_stream_next, _yak_stream_flush.
+ */
+{
+    save, state, sock=sock, text=text, len=strlen(text), line=1, off=0;
+    _yak_stream_next, state;
+}
+
+func _yak_stream_next(state)
+/* DOCUMENT _yak_stream_next, state;
+
+     Private subroutine to send the next chunk of the result being streamed to a client
+     whose state is stored in object `state`. Whole lines of the result are packed in the
+     chunk as long as they fit, a line longer than the chunk size is split.
+
+   SEE ALSO: _yak_stream_start.
+ */
+{
+    text = state.text;
+    if (is_void(text)) {
+        return;
+    }
+    len = state.len;
+    n = numberof(text);
+    i = state.line;
+    off = state.off;
+    room = state.chunk;
+    size = len(i) - off;
+    if (size > room) {
+        chunk = strpart(text(i), off+1:off+room);
+        off += room;
+    } else {
+        j = i;
+        while (j < n && size + len(j+1) <= room) {
+            size += len(++j);
+        }
+        chunk = (off > 0 ? strpart(text(i), off+1:len(i)) : text(i));
+        if (j > i) {
+            chunk += sum(text(i+1:j));
+        }
+        i = j + 1;
+        off = 0;
+    }
+    last = (i > n);
+    if (last) {
+        save, state, text=[], len=[];
+    } else {
+        save, state, line=i, off=off;
+    }
+    err = yak_send_message(state.sock, (last ? 'R' : 'K'), chunk);
+    if (! is_void(err)) {
+        save, state, text=[], len=[];
+        _yak_error, err;
+    } else if (! last && ! state.scheduled) {
+        save, state, scheduled=1n;
+        after, 0.0, _yak_stream_callback, state;
+    }
+}
+
+func _yak_stream_callback(state)
+/* DOCUMENT _yak_stream_callback, state;
+
+     Private callback to send the next chunk of a streamed result.
+
+   SEE ALSO: _yak_stream_next.
+ */
+{
+    save, state, scheduled=0n;
+    _yak_stream_next, state;
+}
+
+func _yak_stream_flush(state)
+/* DOCUMENT _yak_stream_flush, state;
+
+     Private subroutine to send all the remaining chunks of the result being streamed to
+     a client, if any, so that the next answer comes after it.
+
+   SEE ALSO: _yak_stream_next.
+ */
+{
+    while (! is_void(state.text)) {
+        _yak_stream_next, state;
+    }
+}
+
+func _yak_admit(state, type)
+/* DOCUMENT ok = _yak_admit(state, type);
+
+     Private function to apply the rate limits to a message of type `type` received from
+     a client whose state is stored in object `state`. Return whether the message is
+     admitted.
+
+   SEE ALSO: yak_rate_limit.
+ */
+{
+    n = numberof(_yak_limit_type);
+    if (n == 0) {
+        return 1n;
+    }
+    now = array(double, 3);
+    timer, now;
+    now = now(3); // wall time
+    tokens = state.tokens;
+    if (numberof(tokens) != n) {
+        // Limits have changed, start with full buckets.
+        tokens = _yak_limit_burst;
+    } else {
+        tokens = min(_yak_limit_burst, tokens + (now - state.time)*_yak_limit_rate);
+    }
+    j = where((_yak_limit_type == '\0') | (_yak_limit_type == type));
+    ok = (! is_array(j) || min(tokens(j)) >= 1.0);
+    if (ok && is_array(j)) {
+        tokens(j) -= 1.0;
+    }
+    save, state, tokens=tokens, time=now;
+    return ok;
+}
+
 local _yak_eval_result, _yak_eval_status;
 local _yak_eval_assign, _yak_eval_expression, _yak_eval_subroutine;
 func _yak_eval(_yak_eval_expr, &_yak_eval_type)